@@ -2,23 +2,33 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
+#include <errno.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <csignal>
+#include <map>
 #include <vector>
 #include <utility>
 #include <iostream>
 #include "db/db_impl.h"
 #include "db/version_set.h"
+#include "helpers/memenv/memenv.h"
 #include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/write_batch.h"
 #include "port/port.h"
 #include "util/crc32c.h"
-#include "util/histogram.h"
+#include "util/hdr_histogram.h"
 #include "util/mutexlock.h"
 #include "util/random.h"
 #include "util/testutil.h"
@@ -38,6 +48,13 @@
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
 //      seekrandom    -- N random seeks
+//      ycsba         -- YCSB workload A: 50% reads, 50% updates
+//      ycsbb         -- YCSB workload B: 95% reads, 5% updates
+//      ycsbc         -- YCSB workload C: 100% reads
+//      ycsbd         -- YCSB workload D: 95% reads of recent keys, 5% inserts
+//      ycsbe         -- YCSB workload E: 95% short scans, 5% inserts
+//      ycsbf         -- YCSB workload F: 50% reads, 50% read-modify-writes
+//      ycsb          -- YCSB mix given by the --ycsb_* flags
 //      open          -- cost of opening a DB
 //      crc32c        -- repeated crc32c of 4K of data
 //      acquireload   -- load N*1000 times
@@ -123,14 +140,88 @@ static bool FLAGS_reuse_logs = false;
 // Use the db with the following name.
 static const char* FLAGS_db = NULL;
 
+// "default" keeps the DB in files; "mem" keeps it in memory (see
+// helpers/memenv), which takes storage out of lock scaling experiments.
+// An in-memory DB is gone when db_bench exits, so load and measure it in
+// the same run, e.g. --benchmarks=fillseq,readrandom.
+static const char* FLAGS_env = "default";
+
+// If positive, load this many sequential keys with one thread and no
+// time limit before the first benchmark.  Meant for --env=mem, where the
+// DB cannot be loaded by an earlier db_bench run.
+static int FLAGS_load_num = 0;
+
 static int FLAGS_time_ms = 0;
 
+// If true, pin benchmark thread i to cpu i
 static int FLAGS_should_pin_threads = false;
 
+// If non-null, pin benchmark threads to cpus in the order given by this
+// policy, taken from the cpu topology in /sys:
+//   compact  -- one thread per core, filling a socket before the next,
+//               then the SMT siblings in the same order
+//   scatter  -- one thread per core, round-robin over the sockets,
+//               then the SMT siblings in the same order
+//   smt      -- all SMT siblings of a core before the next core
+//   list     -- the cpus given by --pin_cpus, in order
+// Only cpus in the process's affinity mask are used.  With more threads
+// than cpus the order wraps around.
+static const char* FLAGS_pin_policy = NULL;
+
+// Cpus for --pin_policy=list, e.g. "0-3,8,10"
+static const char* FLAGS_pin_cpus = NULL;
+
+// NUMA memory policy for the whole run:
+//   local       -- each benchmark thread allocates on its own node
+//   interleave  -- interleave pages over all nodes
+//   <nodes>     -- allocate only on these nodes, e.g. "0" or "0-1"
+static const char* FLAGS_numa_membind = NULL;
+
 static bool FLAGS_should_stop = false;
 
 static int FLAGS_writers = 1;
 
+// Operation mix of the "ycsb" benchmark, as relative proportions of
+// reads, updates, inserts, scans and read-modify-writes
+static double FLAGS_ycsb_read = 0.5;
+static double FLAGS_ycsb_update = 0.5;
+static double FLAGS_ycsb_insert = 0;
+static double FLAGS_ycsb_scan = 0;
+static double FLAGS_ycsb_rmw = 0;
+
+// Key choice of the "ycsb" benchmark: zipfian, latest or uniform
+static const char* FLAGS_ycsb_distribution = "zipfian";
+
+// Skew of the zipfian and latest key distributions, in (0, 1)
+static double FLAGS_zipf_theta = 0.99;
+
+// Scans of YCSB workloads read between 1 and this many entries
+static int FLAGS_max_scan_length = 100;
+
+// If positive, run open-loop at this many operations per second in
+// total: each thread issues operations on a fixed arrival schedule and
+// latency is measured from the scheduled start of each operation, so
+// time spent queued behind a stall is not omitted.
+static double FLAGS_rate = 0;
+
+// Significant digits of precision kept by the latency histograms (1..4).
+// Each thread keeps up to 8 histograms of latencies up to 60s, of about
+// 30KB, 210KB or 2.9MB each for 2, 3 or 4 digits.
+static int FLAGS_hdr_digits = 3;
+
+// If non-null, write the full latency distributions of every benchmark
+// to this file: JSON lines if its name ends in ".json", CSV otherwise.
+static const char* FLAGS_latency_export = NULL;
+
+// If non-null, append per-interval throughput and latency percentiles,
+// per thread and over all threads, to this CSV file.  Rows are written
+// by a reporter thread as the benchmark threads move past each interval,
+// so the rows of a stalled thread, and of all threads, can come late.
+static const char* FLAGS_report_file = NULL;
+
+// Length of the intervals written to --report_file
+static int FLAGS_report_interval_ms = 100;
+
 static void sighandler(int x) {
   FLAGS_should_stop = true;
 }
@@ -172,6 +263,287 @@ class RandomGenerator {
   }
 };
 
+// Monotonic clock for latency measurements, which need a finer
+// resolution than Env::NowMicros().
+static uint64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Sleep until NowNanos() reaches "when"
+static void SleepUntilNanos(uint64_t when) {
+  struct timespec ts;
+  ts.tv_sec = when / 1000000000;
+  ts.tv_nsec = when % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield" ::: "memory");
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+// Parse a cpu or node list such as "0-3,8,10-11" into *ids.
+static bool ParseIdList(const char* s, std::vector<int>* ids) {
+  ids->clear();
+  while (*s != '\0' && *s != '\n') {
+    char* end;
+    const long first = strtol(s, &end, 10);
+    if (end == s || first < 0) return false;
+    long last = first;
+    s = end;
+    if (*s == '-') {
+      last = strtol(s + 1, &end, 10);
+      if (end == s + 1 || last < first) return false;
+      s = end;
+    }
+    for (long id = first; id <= last; id++) {
+      ids->push_back(static_cast<int>(id));
+    }
+    if (*s == ',') s++;
+    else if (*s != '\0' && *s != '\n') return false;
+  }
+  return !ids->empty();
+}
+
+// Read the first line of a file under /sys, or return false.
+static bool ReadSysLine(const std::string& path, std::string* line) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (f == NULL) return false;
+  char buf[4096];
+  const bool ok = fgets(buf, sizeof(buf), f) != NULL;
+  fclose(f);
+  if (ok) *line = buf;
+  return ok;
+}
+
+static int ReadSysInt(const std::string& path, int default_value) {
+  std::string line;
+  return ReadSysLine(path, &line) ? atoi(line.c_str()) : default_value;
+}
+
+// Where a cpu sits in the machine
+struct CpuPlace {
+  int cpu;
+  int socket;
+  int core;     // Core id, unique within the socket
+  int sibling;  // Index of the cpu among the SMT siblings of its core
+  int rank;     // Index of the core among the cores of its socket
+
+  static bool Compact(const CpuPlace& a, const CpuPlace& b) {
+    if (a.sibling != b.sibling) return a.sibling < b.sibling;
+    if (a.socket != b.socket) return a.socket < b.socket;
+    if (a.core != b.core) return a.core < b.core;
+    return a.cpu < b.cpu;
+  }
+
+  static bool Scatter(const CpuPlace& a, const CpuPlace& b) {
+    if (a.sibling != b.sibling) return a.sibling < b.sibling;
+    if (a.rank != b.rank) return a.rank < b.rank;
+    if (a.socket != b.socket) return a.socket < b.socket;
+    return a.cpu < b.cpu;
+  }
+
+  static bool SMT(const CpuPlace& a, const CpuPlace& b) {
+    if (a.socket != b.socket) return a.socket < b.socket;
+    if (a.core != b.core) return a.core < b.core;
+    return a.sibling < b.sibling;
+  }
+};
+
+// Cpus that benchmark thread i is pinned to, as g_pin_cpus[i % size]
+static std::vector<int> g_pin_cpus;
+
+// Fill g_pin_cpus according to --pin_policy.
+static void ComputePinOrder() {
+  if (strcmp(FLAGS_pin_policy, "list") == 0) {
+    if (FLAGS_pin_cpus == NULL || !ParseIdList(FLAGS_pin_cpus, &g_pin_cpus)) {
+      fprintf(stderr, "--pin_policy=list needs a valid --pin_cpus\n");
+      exit(1);
+    }
+    return;
+  }
+
+  std::string line;
+  std::vector<int> online;
+  if (!ReadSysLine("/sys/devices/system/cpu/online", &line) ||
+      !ParseIdList(line.c_str(), &online)) {
+    fprintf(stderr, "cannot read the cpu topology\n");
+    exit(1);
+  }
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    for (size_t i = 0; i < online.size(); i++) {
+      CPU_SET(online[i], &allowed);
+    }
+  }
+
+  std::vector<CpuPlace> places;
+  for (size_t i = 0; i < online.size(); i++) {
+    const int cpu = online[i];
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+    char dir[100];
+    snprintf(dir, sizeof(dir), "/sys/devices/system/cpu/cpu%d/topology/", cpu);
+    CpuPlace p;
+    p.cpu = cpu;
+    p.socket = ReadSysInt(std::string(dir) + "physical_package_id", 0);
+    p.core = ReadSysInt(std::string(dir) + "core_id", cpu);
+    p.sibling = 0;
+    std::vector<int> siblings;
+    if (ReadSysLine(std::string(dir) + "thread_siblings_list", &line) &&
+        ParseIdList(line.c_str(), &siblings)) {
+      for (size_t j = 0; j < siblings.size() && siblings[j] < cpu; j++) {
+        p.sibling++;
+      }
+    }
+    places.push_back(p);
+  }
+  for (size_t i = 0; i < places.size(); i++) {
+    std::vector<int> cores;
+    for (size_t j = 0; j < places.size(); j++) {
+      if (places[j].socket == places[i].socket &&
+          places[j].core < places[i].core &&
+          std::find(cores.begin(), cores.end(), places[j].core) ==
+              cores.end()) {
+        cores.push_back(places[j].core);
+      }
+    }
+    places[i].rank = cores.size();
+  }
+
+  if (strcmp(FLAGS_pin_policy, "compact") == 0) {
+    std::sort(places.begin(), places.end(), CpuPlace::Compact);
+  } else if (strcmp(FLAGS_pin_policy, "scatter") == 0) {
+    std::sort(places.begin(), places.end(), CpuPlace::Scatter);
+  } else {
+    std::sort(places.begin(), places.end(), CpuPlace::SMT);
+  }
+  for (size_t i = 0; i < places.size(); i++) {
+    g_pin_cpus.push_back(places[i].cpu);
+  }
+}
+
+// Memory policy modes of set_mempolicy(2), which glibc does not declare
+enum {
+  kMemPolicyBind = 2,
+  kMemPolicyInterleave = 3,
+  kMemPolicyLocal = 4
+};
+
+// Apply a NUMA memory policy to the calling thread; threads created
+// afterwards inherit it.
+static void SetMemPolicy(int mode, const std::vector<int>& nodes) {
+#ifdef SYS_set_mempolicy
+  unsigned long mask[16];
+  memset(mask, 0, sizeof(mask));
+  const int bits = sizeof(unsigned long) * 8;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i] < 16 * bits) {
+      mask[nodes[i] / bits] |= 1ul << (nodes[i] % bits);
+    }
+  }
+  if (syscall(SYS_set_mempolicy, mode, nodes.empty() ? NULL : mask,
+              nodes.empty() ? 0 : 16 * bits + 1) != 0) {
+    fprintf(stderr, "set_mempolicy: %s\n", strerror(errno));
+    exit(1);
+  }
+#else
+  fprintf(stderr, "--numa_membind is not supported on this platform\n");
+  exit(1);
+#endif
+}
+
+// Apply the process-wide part of --numa_membind
+static void SetupMemPolicy() {
+  if (strcmp(FLAGS_numa_membind, "local") == 0) {
+    return;  // Set by each benchmark thread
+  }
+  std::vector<int> nodes;
+  if (strcmp(FLAGS_numa_membind, "interleave") == 0) {
+    std::string line;
+    if (!ReadSysLine("/sys/devices/system/node/online", &line) ||
+        !ParseIdList(line.c_str(), &nodes)) {
+      nodes.assign(1, 0);
+    }
+    SetMemPolicy(kMemPolicyInterleave, nodes);
+  } else if (ParseIdList(FLAGS_numa_membind, &nodes)) {
+    SetMemPolicy(kMemPolicyBind, nodes);
+  } else {
+    fprintf(stderr, "invalid --numa_membind '%s'\n", FLAGS_numa_membind);
+    exit(1);
+  }
+}
+
+// Whether --latency_export names a JSON rather than a CSV file.
+static bool LatencyExportIsJSON() {
+  const size_t len = strlen(FLAGS_latency_export);
+  return len >= 5 && strcmp(FLAGS_latency_export + len - 5, ".json") == 0;
+}
+
+// Returns a uniformly distributed double in [0, 1).
+static double NextDouble(Random* rnd) {
+  // Random::Next() returns values in [1, 2^31-2]
+  return (rnd->Next() - 1) / 2147483646.0;
+}
+
+// Generates integers in [0, n) following a Zipfian distribution of
+// parameter theta, where 0 is the most popular item, using the method of
+// Gray et al., "Quickly Generating Billion-Record Synthetic Databases"
+// (as does YCSB).  Next() is thread-safe given a per-thread Random.
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t n, double theta)
+      : n_(n), theta_(theta) {
+    const double zeta2 = Zeta(2, theta);
+    zetan_ = Zeta(n, theta);
+    alpha_ = 1.0 / (1.0 - theta);
+    eta_ = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+  }
+
+  uint64_t Next(Random* rnd) const {
+    const double u = NextDouble(rnd);
+    const double uz = u * zetan_;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + pow(0.5, theta_)) return 1;
+    uint64_t r = static_cast<uint64_t>(n_ * pow(eta_ * u - eta_ + 1, alpha_));
+    return (r < n_) ? r : n_ - 1;
+  }
+
+ private:
+  const uint64_t n_;
+  const double theta_;
+  double zetan_;
+  double alpha_;
+  double eta_;
+
+  static double Zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+      sum += 1.0 / pow(static_cast<double>(i), theta);
+    }
+    return sum;
+  }
+};
+
+// FNV-1a hash, used to scatter popular Zipfian items over the key space
+static uint64_t FNVHash64(uint64_t v) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (int i = 0; i < 8; i++) {
+    h ^= v & 0xff;
+    h *= 1099511628211ull;
+    v >>= 8;
+  }
+  return h;
+}
+
 #if defined(__linux)
 static Slice TrimSpace(Slice s) {
   size_t start = 0;
@@ -194,6 +566,195 @@ static void AppendWithSpace(std::string* str, Slice msg) {
   str->append(msg.data(), msg.size());
 }
 
+// Kinds of operations whose latencies Stats tracks separately
+enum OpType {
+  kOpRead,
+  kOpWrite,
+  kOpScan,
+  kOpReadModifyWrite,
+  kNumOpTypes
+};
+
+static const char* kOpTypeNames[kNumOpTypes] = {
+  "read", "write", "scan", "rmw"
+};
+
+// Collects the per-interval results of the threads running a benchmark
+// and writes them to --report_file.  Each thread owns two slots: it
+// records an interval in one of them and hands it over once it has moved
+// past the interval, then records into the other.  A reporter thread
+// drains the slots that were handed over, writes the rows of each
+// thread, and writes the row for all threads when the last thread has
+// handed in the interval, or in Finish().  The benchmark threads thus
+// never take a lock or do any I/O for the report.
+//
+// A thread moves past an interval with its first operation after it, so
+// the rows of a stalled thread, and the row for all threads, are only
+// written once the stall is over.
+class IntervalReporter {
+ public:
+  // The results of thread "tid" for interval "index", and for the
+  // intervals up to "next" - 1 in which it did not finish any operation
+  struct Slot {
+    HdrHistogram hist;
+    uint64_t ops;
+    int index;
+    int next;
+    port::AtomicPointer full;  // Non-NULL while handed to the reporter
+
+    Slot() : hist(FLAGS_hdr_digits), ops(0), index(0), next(0), full(NULL) { }
+  };
+
+  IntervalReporter(FILE* file, const Slice& name, int threads)
+      : file_(file),
+        name_(name.ToString()),
+        threads_(threads),
+        interval_nanos_(static_cast<uint64_t>(FLAGS_report_interval_ms) *
+                        1000000),
+        start_(0),
+        slots_(new Slot[2 * threads]),
+        empty_(FLAGS_hdr_digits),
+        stop_(NULL),
+        done_cv_(&mu_),
+        running_(false) {
+  }
+
+  ~IntervalReporter() {
+    Finish();
+    delete[] slots_;
+  }
+
+  // Interval 0 begins now
+  void Start() {
+    start_ = NowNanos();
+    running_ = true;
+    g_env->StartThread(&IntervalReporter::ReporterThread, this);
+  }
+
+  int IntervalAt(uint64_t now) const {
+    return now > start_ ? static_cast<int>((now - start_) / interval_nanos_)
+                        : 0;
+  }
+
+  // The slot thread "tid" records its first interval in
+  Slot* FirstSlot(int tid) {
+    return &slots_[2 * tid];
+  }
+
+  // Hand "slot" of thread "tid" over to the reporter and return the
+  // cleared slot to record the next interval in.
+  Slot* Handover(int tid, Slot* slot) {
+    slot->full.Release_Store(slot);
+    Slot* other = (slot == &slots_[2 * tid]) ? slot + 1 : slot - 1;
+    while (other->full.Acquire_Load() != NULL) {
+      // The reporter is a whole interval behind
+      g_env->SleepForMicroseconds(100);
+    }
+    other->hist.Clear();
+    other->ops = 0;
+    return other;
+  }
+
+  // Write the rows handed in so far, and the intervals some threads
+  // never reached.  REQUIRES: the benchmark threads are done.
+  void Finish() {
+    if (running_) {
+      stop_.Release_Store(this);
+      MutexLock l(&mu_);
+      while (running_) {
+        done_cv_.Wait();
+      }
+    }
+    for (std::map<int, Interval>::iterator it = pending_.begin();
+         it != pending_.end(); ++it) {
+      WriteRow(it->first, "all", it->second.ops, it->second.hist);
+    }
+    pending_.clear();
+    fflush(file_);
+  }
+
+ private:
+  struct Interval {
+    HdrHistogram hist;
+    uint64_t ops;
+    int threads;
+
+    Interval() : hist(FLAGS_hdr_digits), ops(0), threads(0) { }
+  };
+
+  static void ReporterThread(void* arg) {
+    reinterpret_cast<IntervalReporter*>(arg)->Run();
+  }
+
+  void Run() {
+    const int sleep_micros =
+        std::max(1000, FLAGS_report_interval_ms * 1000 / 4);
+    while (true) {
+      // Everything handed over before stop_ is drained by this pass
+      const bool stopping = stop_.Acquire_Load() != NULL;
+      for (int i = 0; i < 2 * threads_; i++) {
+        if (slots_[i].full.Acquire_Load() != NULL) {
+          Drain(i / 2, &slots_[i]);
+          slots_[i].full.Release_Store(NULL);
+        }
+      }
+      if (stopping) {
+        break;
+      }
+      g_env->SleepForMicroseconds(sleep_micros);
+    }
+    MutexLock l(&mu_);
+    running_ = false;
+    done_cv_.SignalAll();
+  }
+
+  // Only called by the reporter thread, or once it is gone
+  void Drain(int tid, const Slot* slot) {
+    char thread[20];
+    snprintf(thread, sizeof(thread), "%d", tid);
+    for (int index = slot->index; index < slot->next; index++) {
+      // Stalled for the whole of the intervals after the first one
+      const bool first = (index == slot->index);
+      const uint64_t ops = first ? slot->ops : 0;
+      const HdrHistogram& hist = first ? slot->hist : empty_;
+      WriteRow(index, thread, ops, hist);
+      std::map<int, Interval>::iterator it = pending_.find(index);
+      if (it == pending_.end()) {
+        it = pending_.insert(std::make_pair(index, Interval())).first;
+      }
+      Interval* interval = &it->second;
+      interval->hist.Merge(hist);
+      interval->ops += ops;
+      if (++interval->threads == threads_) {
+        WriteRow(index, "all", interval->ops, interval->hist);
+        pending_.erase(it);
+      }
+    }
+  }
+
+  void WriteRow(int index, const char* thread, uint64_t ops,
+                const HdrHistogram& hist) {
+    fprintf(file_, "%s,%d,%d,%s,%llu,%.1f,%.3f,%.3f,%.3f,%.3f\n",
+            name_.c_str(), index, index * FLAGS_report_interval_ms, thread,
+            static_cast<unsigned long long>(ops), ops * 1e9 / interval_nanos_,
+            hist.Percentile(50) * 1e-3, hist.Percentile(99) * 1e-3,
+            hist.Percentile(99.9) * 1e-3, hist.Max() * 1e-3);
+  }
+
+  FILE* const file_;
+  const std::string name_;
+  const int threads_;
+  const uint64_t interval_nanos_;
+  uint64_t start_;
+  Slot* const slots_;                // Two per thread
+  const HdrHistogram empty_;
+  std::map<int, Interval> pending_;  // Intervals not all threads handed in
+  port::AtomicPointer stop_;         // Non-NULL once Finish() was called
+  port::Mutex mu_;
+  port::CondVar done_cv_;            // Signalled when the reporter exits
+  bool running_;                     // Protected by mu_ once started
+};
+
 class Stats {
  private:
   double start_;
@@ -202,8 +763,8 @@ class Stats {
   int done_;
   int next_report_;
   int64_t bytes_;
-  double last_op_finish_;
-  Histogram hist_;
+  uint64_t last_op_finish_;  // In nanos, like all the histograms
+  HdrHistogram hist_;
   std::string message_;
   std::vector<std::pair<unsigned long, double>> cdf_data_;
 
@@ -211,14 +772,95 @@ class Stats {
   double wstart_;
   double wfinish_;
   double wseconds_;
-  Histogram whist_;
+  HdrHistogram whist_;
+
+  // Latency of each kind of operation from its intended start
+  std::vector<HdrHistogram> op_hist_;
+
+  // Operations of the current interval when --report_file is given
+  IntervalReporter* intervals_;
+  IntervalReporter::Slot* interval_;  // Where they are recorded
+  int tid_;
+  int interval_index_;
+  uint64_t last_interval_op_;
+
+  // Record an operation that finished at "now" and took "latency"
+  // nanos in the per-interval results.
+  void IntervalOp(uint64_t now, uint64_t latency) {
+    const int index = intervals_->IntervalAt(now);
+    if (index != interval_index_) {
+      EndInterval(index);
+    }
+    interval_->hist.Add(latency);
+    interval_->ops++;
+    last_interval_op_ = now;
+  }
+
+  // Hand in the current interval and any empty ones before "next"
+  void EndInterval(int next) {
+    interval_->index = interval_index_;
+    interval_->next = next;
+    interval_ = intervals_->Handover(tid_, interval_);
+    interval_index_ = next;
+  }
+
+  void CountOp() {
+    if (FLAGS_histogram) {
+      uint64_t now = NowNanos();
+      uint64_t nanos = now - last_op_finish_;
+      hist_.Add(nanos);
+      if (nanos > 20000000) {
+        fprintf(stderr, "long op: %.1f micros%30s\r", nanos * 1e-3, "");
+        fflush(stderr);
+      }
+      last_op_finish_ = now;
+    }
+
+    done_++;
+    if (FLAGS_CDF) {
+      if ((done_ % FLAGS_CDF_LOG_GRAN) == 0) {
+        double now = (g_env->NowMicros() - start_) * 1e-6;
+        cdf_data_.push_back(std::make_pair(done_, (now)));
+      }
+    }
+    if (done_ >= next_report_) {
+      if      (next_report_ < 1000)   next_report_ += 100;
+      else if (next_report_ < 5000)   next_report_ += 500;
+      else if (next_report_ < 10000)  next_report_ += 1000;
+      else if (next_report_ < 50000)  next_report_ += 5000;
+      else if (next_report_ < 100000) next_report_ += 10000;
+      else if (next_report_ < 500000) next_report_ += 50000;
+      else                            next_report_ += 100000;
+      fprintf(stderr, "... finished %d ops%30s\r", done_, "");
+      fflush(stderr);
+    }
+  }
 
  public:
-  Stats() { Start(); }
+  Stats()
+      : hist_(FLAGS_hdr_digits),
+        whist_(FLAGS_hdr_digits),
+        op_hist_(kNumOpTypes, HdrHistogram(FLAGS_hdr_digits)),
+        intervals_(NULL),
+        interval_(NULL),
+        tid_(0) {
+    Start();
+  }
+
+  // Report the results of every interval to "r" as thread "tid"
+  void StartIntervals(IntervalReporter* r, int tid) {
+    intervals_ = r;
+    interval_ = r->FirstSlot(tid);
+    interval_->hist.Clear();
+    interval_->ops = 0;
+    tid_ = tid;
+    interval_index_ = r->IntervalAt(NowNanos());
+    last_interval_op_ = NowNanos();
+  }
 
   void Start() {
     next_report_ = 100;
-    last_op_finish_ = start_;
+    last_op_finish_ = NowNanos();
     hist_.Clear();
     done_ = 0;
     bytes_ = 0;
@@ -232,6 +874,9 @@ class Stats {
     wfinish_ = 0;
     wseconds_ = 0;
     whist_.Clear();
+    for (int i = 0; i < kNumOpTypes; i++) {
+      op_hist_[i].Clear();
+    }
   }
 
   void Merge(const Stats& other) {
@@ -244,11 +889,19 @@ class Stats {
 
     wdone_ += other.wdone_;
     wseconds_ += other.wseconds_;
+    for (int i = 0; i < kNumOpTypes; i++) {
+      op_hist_[i].Merge(other.op_hist_[i]);
+    }
     // Just keep the messages from one thread
     if (message_.empty()) message_ = other.message_;
   }
 
   void Stop() {
+    if (intervals_ != NULL) {
+      // Hand in the partial last interval
+      EndInterval(interval_index_ + 1);
+      intervals_ = NULL;
+    }
     finish_ = g_env->NowMicros();
     wfinish_ = finish_;
     seconds_ = (finish_ - start_) * 1e-6;
@@ -260,44 +913,25 @@ class Stats {
   }
 
   void FinishedSingleOp() {
-    if (FLAGS_histogram) {
-      double now = g_env->NowMicros();
-      double micros = now - last_op_finish_;
-      hist_.Add(micros);
-      if (micros > 20000) {
-        fprintf(stderr, "long op: %.1f micros%30s\r", micros, "");
-        fflush(stderr);
-      }
-      last_op_finish_ = now;
-    }
-
-    done_++;
-    if (FLAGS_CDF) {
-      if ((done_ % FLAGS_CDF_LOG_GRAN) == 0) {
-        double now = (g_env->NowMicros() - start_) * 1e-6;
-        cdf_data_.push_back(std::make_pair(done_, (now)));
-      }
-    }
-    if (done_ >= next_report_) {
-      if      (next_report_ < 1000)   next_report_ += 100;
-      else if (next_report_ < 5000)   next_report_ += 500;
-      else if (next_report_ < 10000)  next_report_ += 1000;
-      else if (next_report_ < 50000)  next_report_ += 5000;
-      else if (next_report_ < 100000) next_report_ += 10000;
-      else if (next_report_ < 500000) next_report_ += 50000;
-      else                            next_report_ += 100000;
-      fprintf(stderr, "... finished %d ops%30s\r", done_, "");
-      fflush(stderr);
+    if (intervals_ != NULL) {
+      // Without a start time, an op's latency is the time since the last
+      const uint64_t now = NowNanos();
+      IntervalOp(now, now - last_interval_op_);
     }
+    CountOp();
   }
 
   void FinishedWSingleOp() {
+    if (intervals_ != NULL) {
+      const uint64_t now = NowNanos();
+      IntervalOp(now, now - last_interval_op_);
+    }
     if (FLAGS_histogram) {
-      double now = g_env->NowMicros();
-      double micros = now - last_op_finish_;
-      whist_.Add(micros);
-      if (micros > 20000) {
-        fprintf(stderr, "long op: %.1f micros%30s\r", micros, "");
+      uint64_t now = NowNanos();
+      uint64_t nanos = now - last_op_finish_;
+      whist_.Add(nanos);
+      if (nanos > 20000000) {
+        fprintf(stderr, "long op: %.1f micros%30s\r", nanos * 1e-3, "");
         fflush(stderr);
       }
       last_op_finish_ = now;
@@ -311,6 +945,18 @@ class Stats {
     }
   }
 
+  // Record an operation of kind "type" that was meant to start at
+  // "op_start" (NowNanos()) and has just finished.
+  void FinishedOp(OpType type, uint64_t op_start) {
+    const uint64_t now = NowNanos();
+    const uint64_t latency = now > op_start ? now - op_start : 0;
+    op_hist_[type].Add(latency);
+    if (intervals_ != NULL) {
+      IntervalOp(now, latency);
+    }
+    CountOp();
+  }
+
   void AddBytes(int64_t n) {
     bytes_ += n;
   }
@@ -351,12 +997,65 @@ class Stats {
               wseconds_ * 1e6 / wdone_, wdone_);
     else fprintf(stdout, "\n");
     if (FLAGS_histogram) {
-      fprintf(stdout, "Microseconds per op:\n%s\n", hist_.ToString().c_str());
+      fprintf(stdout, "Microseconds per op:\n%s\n",
+              hist_.ToString(1e3).c_str());
       if (wdone_ > 0)
-        fprintf(stdout, "Microseconds per op:\n%s\n", whist_.ToString().c_str());
+        fprintf(stdout, "Microseconds per op:\n%s\n",
+                whist_.ToString(1e3).c_str());
+    }
+    if (FLAGS_rate > 0 || FLAGS_histogram) {
+      for (int i = 0; i < kNumOpTypes; i++) {
+        const HdrHistogram& h = op_hist_[i];
+        if (h.Count() == 0) continue;
+        fprintf(stdout, "  %-6s latency (micros): p50 %.3f p99 %.3f "
+                "p99.9 %.3f p99.99 %.3f (%llu ops)\n",
+                kOpTypeNames[i], h.Percentile(50) * 1e-3,
+                h.Percentile(99) * 1e-3, h.Percentile(99.9) * 1e-3,
+                h.Percentile(99.99) * 1e-3,
+                static_cast<unsigned long long>(h.Count()));
+      }
     }
     fflush(stdout);
   }
+
+  // Write the full latency distributions recorded for benchmark "name"
+  // to "f" in the format selected by --latency_export.
+  void ExportLatencies(const Slice& name, FILE* f) {
+    const HdrHistogram* hists[kNumOpTypes + 2];
+    const char* labels[kNumOpTypes + 2];
+    int n = 0;
+    for (int i = 0; i < kNumOpTypes; i++) {
+      hists[n] = &op_hist_[i];
+      labels[n++] = kOpTypeNames[i];
+    }
+    hists[n] = &hist_;
+    labels[n++] = "interval";
+    hists[n] = &whist_;
+    labels[n++] = "write_interval";
+
+    const bool json = LatencyExportIsJSON();
+    for (int i = 0; i < n; i++) {
+      if (hists[i]->Count() == 0) continue;
+      std::string data;
+      if (json) {
+        hists[i]->ExportJSON(&data);
+        fprintf(f, "{\"benchmark\": \"%s\", \"op\": \"%s\", "
+                "\"unit\": \"ns\", \"histogram\": %s}\n",
+                name.ToString().c_str(), labels[i], data.c_str());
+      } else {
+        // Prefix every row but the header with the benchmark and op
+        hists[i]->ExportCSV(&data);
+        size_t pos = data.find('\n') + 1;
+        while (pos < data.size()) {
+          size_t end = data.find('\n', pos);
+          fprintf(f, "%s,%s,%.*s\n", name.ToString().c_str(), labels[i],
+                  static_cast<int>(end - pos), data.data() + pos);
+          pos = end + 1;
+        }
+      }
+    }
+    fflush(f);
+  }
 };
 
 // State shared by all concurrent executions of the same benchmark.
@@ -364,6 +1063,7 @@ struct SharedState {
   port::Mutex mu;
   port::CondVar cv;
   int total;
+  IntervalReporter* intervals;  // NULL unless --report_file is given
 
   // Each thread goes through the following states:
   //    (1) initializing
@@ -375,6 +1075,9 @@ struct SharedState {
   int num_done;
   bool start;
 
+  // Keys handed out by YCSB inserts after the FLAGS_num loaded ones
+  int ycsb_inserts;
+
   SharedState() : cv(&mu) { }
 };
 
@@ -384,15 +1087,31 @@ struct ThreadState {
   Random rand;         // Has different seeds for different threads
   Stats stats;
   SharedState* shared;
+  uint64_t next_op_start;  // Intended start (nanos) of the next op
+                           // in open-loop mode
 
   ThreadState(int index)
       : tid(index),
-        rand(1000 + index) {
+        rand(1000 + index),
+        next_op_start(0) {
   }
 };
 
 }  // namespace
 
+// Operation mix and key distribution of a YCSB workload
+struct YCSBWorkload {
+  enum Distribution { kZipfian, kLatest, kUniform };
+
+  // Relative proportions of each kind of operation
+  double read;
+  double update;
+  double insert;
+  double scan;
+  double rmw;
+  Distribution distribution;
+};
+
 class Benchmark {
  private:
   Cache* cache_;
@@ -405,6 +1124,10 @@ class Benchmark {
   int reads_;
   int writes_;
   int heap_counter_;
+  YCSBWorkload ycsb_;
+  ZipfianGenerator* zipf_;  // Over FLAGS_num keys, created on first use
+  FILE* latency_file_;      // Open iff --latency_export was given
+  FILE* report_file_;       // Open iff --report_file was given
 
   void PrintHeader() {
     const int kKeySize = 16;
@@ -420,6 +1143,19 @@ class Benchmark {
     fprintf(stdout, "FileSize:   %.1f MB (estimated)\n",
             (((kKeySize + FLAGS_value_size * FLAGS_compression_ratio) * num_)
              / 1048576.0));
+    if (!g_pin_cpus.empty()) {
+      fprintf(stdout, "Pinning:    %s, threads on cpus", FLAGS_pin_policy);
+      for (size_t i = 0; i < g_pin_cpus.size(); i++) {
+        fprintf(stdout, "%s%d", (i == 0 ? " " : ","), g_pin_cpus[i]);
+      }
+      fprintf(stdout, "\n");
+    }
+    if (FLAGS_numa_membind != NULL) {
+      fprintf(stdout, "NUMA:       memory policy %s\n", FLAGS_numa_membind);
+    }
+    if (strcmp(FLAGS_env, "mem") == 0) {
+      fprintf(stdout, "Env:        in-memory\n");
+    }
     PrintWarnings();
     fprintf(stdout, "------------------------------------------------\n");
   }
@@ -492,7 +1228,10 @@ class Benchmark {
     entries_per_batch_(1),
     reads_(FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads),
     writes_(FLAGS_writes > 0 ? FLAGS_writes : 0),
-    heap_counter_(0) {
+    heap_counter_(0),
+    zipf_(NULL),
+    latency_file_(NULL),
+    report_file_(NULL) {
     std::vector<std::string> files;
     g_env->GetChildren(FLAGS_db, &files);
     for (size_t i = 0; i < files.size(); i++) {
@@ -501,19 +1240,49 @@ class Benchmark {
       }
     }
     if (!FLAGS_use_existing_db) {
-      DestroyDB(FLAGS_db, Options());
+      DestroyDB(FLAGS_db, EnvOptions());
     }
   }
 
+  static Options EnvOptions() {
+    Options options;
+    options.env = g_env;
+    return options;
+  }
+
   ~Benchmark() {
     delete db_;
     delete cache_;
     delete filter_policy_;
+    delete zipf_;
   }
 
   void Run() {
     PrintHeader();
     Open();
+    if (FLAGS_load_num > 0) {
+      Load(FLAGS_load_num);
+    }
+    if (FLAGS_latency_export != NULL) {
+      latency_file_ = fopen(FLAGS_latency_export, "w");
+      if (latency_file_ == NULL) {
+        fprintf(stderr, "cannot open %s\n", FLAGS_latency_export);
+        exit(1);
+      }
+      if (!LatencyExportIsJSON()) {
+        fprintf(latency_file_, "benchmark,op,value,count,"
+                "cumulative_count,percentile\n");
+      }
+    }
+    if (FLAGS_report_file != NULL) {
+      report_file_ = fopen(FLAGS_report_file, "w");
+      if (report_file_ == NULL) {
+        fprintf(stderr, "cannot open %s\n", FLAGS_report_file);
+        exit(1);
+      }
+      fprintf(report_file_, "benchmark,interval,time_ms,thread,ops,"
+              "ops_per_sec,p50_us,p99_us,p99.9_us,max_us\n");
+    }
 
     const char* benchmarks = FLAGS_benchmarks;
     while (benchmarks != NULL) {
@@ -588,6 +1357,8 @@ class Benchmark {
       } else if (name == Slice("readwhilewriting")) {
         num_threads += FLAGS_writers;  // Add extra thread for writing
         method = &Benchmark::ReadWhileWriting;
+      } else if (SetYCSBWorkload(name)) {
+        method = &Benchmark::YCSB;
       } else if (name == Slice("compact")) {
         method = &Benchmark::Compact;
       } else if (name == Slice("crc32c")) {
@@ -618,7 +1389,7 @@ class Benchmark {
         } else {
           delete db_;
           db_ = NULL;
-          DestroyDB(FLAGS_db, Options());
+          DestroyDB(FLAGS_db, EnvOptions());
           Open();
         }
       }
@@ -627,6 +1398,14 @@ class Benchmark {
         RunBenchmark(num_threads, name, method);
       }
     }
+    if (latency_file_ != NULL) {
+      fclose(latency_file_);
+      latency_file_ = NULL;
+    }
+    if (report_file_ != NULL) {
+      fclose(report_file_);
+      report_file_ = NULL;
+    }
   }
 
  private:
@@ -643,8 +1422,15 @@ class Benchmark {
     SharedState* shared = arg->shared;
     ThreadState* thread = arg->thread;
 
-    if (FLAGS_should_pin_threads)
+    if (!g_pin_cpus.empty()) {
+      g_env->PinThread(g_pin_cpus[arg->id % g_pin_cpus.size()]);
+    } else if (FLAGS_should_pin_threads) {
       g_env->PinThread(arg->id);
+    }
+    if (FLAGS_numa_membind != NULL &&
+        strcmp(FLAGS_numa_membind, "local") == 0) {
+      SetMemPolicy(kMemPolicyLocal, std::vector<int>());
+    }
 
     {
       MutexLock l(&shared->mu);
@@ -658,6 +1444,14 @@ class Benchmark {
     }
 
     thread->stats.Start();
+    if (shared->intervals != NULL) {
+      thread->stats.StartIntervals(shared->intervals, thread->tid);
+    }
+    if (FLAGS_rate > 0) {
+      // Stagger the threads' schedules evenly over one interval
+      thread->next_op_start = NowNanos() +
+          static_cast<uint64_t>(1e9 / FLAGS_rate * thread->tid);
+    }
     (arg->bm->*(arg->method))(thread);
     thread->stats.Stop();
 
@@ -677,6 +1471,11 @@ class Benchmark {
     shared.num_initialized = 0;
     shared.num_done = 0;
     shared.start = false;
+    shared.ycsb_inserts = 0;
+    shared.intervals = NULL;
+    if (report_file_ != NULL) {
+      shared.intervals = new IntervalReporter(report_file_, name, n);
+    }
 
     ThreadArg* arg = new ThreadArg[n];
     for (int i = 0; i < n; i++) {
@@ -695,23 +1494,37 @@ class Benchmark {
     }
 
     if (FLAGS_time_ms > 0) {
+      // Left set by the alarm of the previous timed benchmark
+      FLAGS_should_stop = false;
       if (std::signal(SIGALRM, sighandler) == SIG_ERR) {
         FLAGS_should_stop = true;
       }
-      alarm(FLAGS_time_ms / 1000);
+      // alarm() has a one second granularity
+      struct itimerval timer;
+      memset(&timer, 0, sizeof(timer));
+      timer.it_value.tv_sec = FLAGS_time_ms / 1000;
+      timer.it_value.tv_usec = (FLAGS_time_ms % 1000) * 1000;
+      setitimer(ITIMER_REAL, &timer, NULL);
     }
 
+    if (shared.intervals != NULL) {
+      shared.intervals->Start();
+    }
     shared.start = true;
     shared.cv.SignalAll();
     while (shared.num_done < n) {
       shared.cv.Wait();
     }
     shared.mu.Unlock();
+    delete shared.intervals;
 
     for (int i = 1; i < n; i++) {
       arg[0].thread->stats.Merge(arg[i].thread->stats);
     }
     arg[0].thread->stats.Report(name);
+    if (latency_file_ != NULL) {
+      arg[0].thread->stats.ExportLatencies(name, latency_file_);
+    }
     if (FLAGS_CDF) {
       for (int i = 0; i < n; ++i) {
         arg[i].thread->stats.PrintCDF(arg[i].thread->stats);
@@ -724,6 +1537,31 @@ class Benchmark {
     delete[] arg;
   }
 
+  // Return the time at which the thread's next operation is meant to
+  // start.  In open-loop mode this waits for the next arrival on the
+  // thread's schedule; an operation that is already late starts at once
+  // and keeps its scheduled time, so its latency includes the delay.
+  uint64_t NextOpStart(ThreadState* thread) {
+    if (FLAGS_rate <= 0) {
+      return NowNanos();
+    }
+    const uint64_t start = thread->next_op_start;
+    thread->next_op_start += static_cast<uint64_t>(
+        1e9 * FLAGS_threads / FLAGS_rate);
+    // Sleep until shortly before the start time, then spin for the rest:
+    // wake-ups can be late by about that much.  Client threads must stay
+    // off the cpus while they wait, or they would compete with the lock
+    // holders that open-loop mode is meant to leave alone.
+    static const uint64_t kSpinNanos = 50000;
+    if (start > NowNanos() + kSpinNanos) {
+      SleepUntilNanos(start - kSpinNanos);
+    }
+    while (NowNanos() < start) {
+      CpuRelax();
+    }
+    return start;
+  }
+
   void Crc32c(ThreadState* thread) {
     // Checksum about 500MB of data total
     const int size = 4096;
@@ -806,6 +1644,25 @@ class Benchmark {
     }
   }
 
+  // Write keys [0, n) the way fillseq does, in batches of 1000
+  void Load(int n) {
+    RandomGenerator gen;
+    WriteBatch batch;
+    for (int i = 0; i < n; i += 1000) {
+      batch.Clear();
+      for (int k = i; k < n && k < i + 1000; k++) {
+        char key[100];
+        snprintf(key, sizeof(key), "%016d", k);
+        batch.Put(key, gen.Generate(FLAGS_value_size));
+      }
+      Status s = db_->Write(WriteOptions(), &batch);
+      if (!s.ok()) {
+        fprintf(stderr, "load error: %s\n", s.ToString().c_str());
+        exit(1);
+      }
+    }
+  }
+
   void Open() {
     assert(db_ == NULL);
     Options options;
@@ -854,6 +1711,7 @@ class Benchmark {
     int64_t bytes = 0;
     for (int i = 0; (FLAGS_time_ms <= 0)?(i < num_):(!FLAGS_should_stop);
 	 i += entries_per_batch_) {
+      const uint64_t op_start = NextOpStart(thread);
       batch.Clear();
       for (int j = 0; j < entries_per_batch_; j++) {
         const int k = seq ? i+j : (thread->rand.Next() % FLAGS_num);
@@ -861,9 +1719,11 @@ class Benchmark {
         snprintf(key, sizeof(key), "%016d", k);
         batch.Put(key, gen.Generate(value_size_));
         bytes += value_size_ + strlen(key);
-        thread->stats.FinishedSingleOp();
       }
       s = db_->Write(write_options_, &batch);
+      for (int j = 0; j < entries_per_batch_; j++) {
+        thread->stats.FinishedOp(kOpWrite, op_start);
+      }
       if (!s.ok()) {
         fprintf(stderr, "put error: %s\n", s.ToString().c_str());
         exit(1);
@@ -904,23 +1764,25 @@ class Benchmark {
     int found = 0;
     if (FLAGS_time_ms <= 0) {
       for (int i = 0; (writes_ == 0) ? (i < reads_) : !FLAGS_should_stop; i++) {
+        const uint64_t op_start = NextOpStart(thread);
         char key[100];
         const int k = thread->rand.Next() % FLAGS_num;
         snprintf(key, sizeof(key), "%016d", k);
         if (db_->Get(options, key, &value).ok()) {
           found++;
         }
-        thread->stats.FinishedSingleOp();
+        thread->stats.FinishedOp(kOpRead, op_start);
       }
     } else {
       for (int i = 0; !FLAGS_should_stop; i++) {
+        const uint64_t op_start = NextOpStart(thread);
         char key[100];
         const int k = thread->rand.Next() % FLAGS_num;
         snprintf(key, sizeof(key), "%016d", k);
         if (db_->Get(options, key, &value).ok()) {
           found++;
         }
-        thread->stats.FinishedSingleOp();
+        thread->stats.FinishedOp(kOpRead, op_start);
       }
     }
     char msg[100];
@@ -1037,6 +1899,139 @@ class Benchmark {
     }
   }
 
+  // If "name" is a YCSB benchmark, set ycsb_ for it and return true.
+  bool SetYCSBWorkload(const Slice& name) {
+    YCSBWorkload& w = ycsb_;
+    w.read = w.update = w.insert = w.scan = w.rmw = 0;
+    w.distribution = YCSBWorkload::kZipfian;
+    if (name == Slice("ycsba")) {
+      w.read = 0.5;
+      w.update = 0.5;
+    } else if (name == Slice("ycsbb")) {
+      w.read = 0.95;
+      w.update = 0.05;
+    } else if (name == Slice("ycsbc")) {
+      w.read = 1;
+    } else if (name == Slice("ycsbd")) {
+      w.read = 0.95;
+      w.insert = 0.05;
+      w.distribution = YCSBWorkload::kLatest;
+    } else if (name == Slice("ycsbe")) {
+      w.scan = 0.95;
+      w.insert = 0.05;
+    } else if (name == Slice("ycsbf")) {
+      w.read = 0.5;
+      w.rmw = 0.5;
+    } else if (name == Slice("ycsb")) {
+      w.read = FLAGS_ycsb_read;
+      w.update = FLAGS_ycsb_update;
+      w.insert = FLAGS_ycsb_insert;
+      w.scan = FLAGS_ycsb_scan;
+      w.rmw = FLAGS_ycsb_rmw;
+      if (strcmp(FLAGS_ycsb_distribution, "latest") == 0) {
+        w.distribution = YCSBWorkload::kLatest;
+      } else if (strcmp(FLAGS_ycsb_distribution, "uniform") == 0) {
+        w.distribution = YCSBWorkload::kUniform;
+      }
+    } else {
+      return false;
+    }
+    if (w.distribution != YCSBWorkload::kUniform && zipf_ == NULL) {
+      zipf_ = new ZipfianGenerator(FLAGS_num, FLAGS_zipf_theta);
+    }
+    return true;
+  }
+
+  // Pick an existing key for a YCSB operation.  "limit" is the number
+  // of keys in the database, including the ones inserted so far.
+  int YCSBKey(ThreadState* thread, int limit) {
+    switch (ycsb_.distribution) {
+      case YCSBWorkload::kZipfian:
+        return FNVHash64(zipf_->Next(&thread->rand)) % limit;
+      case YCSBWorkload::kLatest: {
+        const int k = limit - 1 - static_cast<int>(zipf_->Next(&thread->rand));
+        return (k < 0) ? 0 : k;
+      }
+      case YCSBWorkload::kUniform:
+      default:
+        return thread->rand.Next() % limit;
+    }
+  }
+
+  void YCSB(ThreadState* thread) {
+    const YCSBWorkload& w = ycsb_;
+    const double total = w.read + w.update + w.insert + w.scan + w.rmw;
+    ReadOptions options;
+    RandomGenerator gen;
+    std::string value;
+    int64_t bytes = 0;
+    int reads = 0;
+    int found = 0;
+    int* inserts = &thread->shared->ycsb_inserts;
+    for (int i = 0; (FLAGS_time_ms <= 0) ? (i < reads_) : !FLAGS_should_stop;
+         i++) {
+      const uint64_t op_start = NextOpStart(thread);
+      // Inserts take the next key after the loaded ones from a counter
+      // shared by all threads.  Stay FLAGS_threads keys behind it, as
+      // each thread may still be writing the last key it took.
+      const int limit = FLAGS_num +
+          std::max(0, __atomic_load_n(inserts, __ATOMIC_RELAXED) -
+                          FLAGS_threads);
+      OpType type = kOpWrite;
+      double p = NextDouble(&thread->rand) * total;
+      char key[100];
+      Status s;
+      if ((p -= w.insert) < 0) {
+        snprintf(key, sizeof(key), "%016d",
+                 FLAGS_num + __atomic_fetch_add(inserts, 1, __ATOMIC_RELAXED));
+        s = db_->Put(write_options_, key, gen.Generate(value_size_));
+        bytes += value_size_ + strlen(key);
+      } else {
+        snprintf(key, sizeof(key), "%016d", YCSBKey(thread, limit));
+        if ((p -= w.read) < 0) {
+          type = kOpRead;
+          reads++;
+          if (db_->Get(options, key, &value).ok()) {
+            found++;
+            bytes += value.size() + strlen(key);
+          }
+        } else if ((p -= w.update) < 0) {
+          s = db_->Put(write_options_, key, gen.Generate(value_size_));
+          bytes += value_size_ + strlen(key);
+        } else if ((p -= w.scan) < 0) {
+          type = kOpScan;
+          const int len = 1 + thread->rand.Uniform(FLAGS_max_scan_length);
+          Iterator* iter = db_->NewIterator(options);
+          int j = 0;
+          for (iter->Seek(key); j < len && iter->Valid(); iter->Next(), j++) {
+            bytes += iter->key().size() + iter->value().size();
+          }
+          delete iter;
+        } else {
+          // Read-modify-write
+          type = kOpReadModifyWrite;
+          reads++;
+          if (db_->Get(options, key, &value).ok()) {
+            found++;
+          }
+          s = db_->Put(write_options_, key, gen.Generate(value_size_));
+          bytes += value_size_ + strlen(key);
+        }
+      }
+      if (!s.ok()) {
+        fprintf(stderr, "put error: %s\n", s.ToString().c_str());
+        exit(1);
+      }
+      thread->stats.FinishedOp(type, op_start);
+    }
+    thread->stats.AddBytes(bytes);
+    if (reads > 0) {
+      char msg[100];
+      snprintf(msg, sizeof(msg), "(%d of %d found)", found, reads);
+      thread->stats.AddMessage(msg);
+    }
+  }
+
   void Compact(ThreadState* thread) {
     db_->CompactRange(NULL, NULL);
   }
@@ -1123,23 +2118,87 @@ int main(int argc, char** argv) {
       FLAGS_open_files = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
+    } else if (sscanf(argv[i], "--load_num=%d%c", &n, &junk) == 1) {
+      FLAGS_load_num = n;
+    } else if (strcmp(argv[i], "--env=default") == 0 ||
+               strcmp(argv[i], "--env=mem") == 0) {
+      FLAGS_env = argv[i] + 6;
+    } else if (strncmp(argv[i], "--report_file=", 14) == 0) {
+      FLAGS_report_file = argv[i] + 14;
+    } else if (sscanf(argv[i], "--report_interval_ms=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_report_interval_ms = n;
+    } else if (strncmp(argv[i], "--latency_export=", 17) == 0) {
+      FLAGS_latency_export = argv[i] + 17;
+    } else if (sscanf(argv[i], "--hdr_digits=%d%c", &n, &junk) == 1 &&
+               n >= 1 && n <= 4) {
+      FLAGS_hdr_digits = n;
     } else if (sscanf(argv[i], "--time_ms=%d%c", &n, &junk) == 1) {
       FLAGS_time_ms = n;
     } else if (sscanf(argv[i], "--pin_threads=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_should_pin_threads = n;
+    } else if (strncmp(argv[i], "--pin_policy=", 13) == 0 &&
+               (strcmp(argv[i] + 13, "compact") == 0 ||
+                strcmp(argv[i] + 13, "scatter") == 0 ||
+                strcmp(argv[i] + 13, "smt") == 0 ||
+                strcmp(argv[i] + 13, "list") == 0)) {
+      FLAGS_pin_policy = argv[i] + 13;
+    } else if (strncmp(argv[i], "--pin_cpus=", 11) == 0) {
+      FLAGS_pin_cpus = argv[i] + 11;
+    } else if (strncmp(argv[i], "--numa_membind=", 15) == 0) {
+      FLAGS_numa_membind = argv[i] + 15;
     } else if (sscanf(argv[i], "--CDF=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_CDF = n;
     } else if (sscanf(argv[i], "--CDF_gran=%d%c", &n, &junk) == 1) {
       FLAGS_CDF_LOG_GRAN = n;
+    } else if (sscanf(argv[i], "--ycsb_read=%lf%c", &d, &junk) == 1) {
+      FLAGS_ycsb_read = d;
+    } else if (sscanf(argv[i], "--ycsb_update=%lf%c", &d, &junk) == 1) {
+      FLAGS_ycsb_update = d;
+    } else if (sscanf(argv[i], "--ycsb_insert=%lf%c", &d, &junk) == 1) {
+      FLAGS_ycsb_insert = d;
+    } else if (sscanf(argv[i], "--ycsb_scan=%lf%c", &d, &junk) == 1) {
+      FLAGS_ycsb_scan = d;
+    } else if (sscanf(argv[i], "--ycsb_rmw=%lf%c", &d, &junk) == 1) {
+      FLAGS_ycsb_rmw = d;
+    } else if (strncmp(argv[i], "--ycsb_distribution=", 20) == 0 &&
+               (strcmp(argv[i] + 20, "zipfian") == 0 ||
+                strcmp(argv[i] + 20, "latest") == 0 ||
+                strcmp(argv[i] + 20, "uniform") == 0)) {
+      FLAGS_ycsb_distribution = argv[i] + 20;
+    } else if (sscanf(argv[i], "--zipf_theta=%lf%c", &d, &junk) == 1 &&
+               d > 0 && d < 1) {
+      FLAGS_zipf_theta = d;
+    } else if (sscanf(argv[i], "--rate=%lf%c", &d, &junk) == 1) {
+      FLAGS_rate = d;
+    } else if (sscanf(argv[i], "--max_scan_length=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_max_scan_length = n;
     } else {
       fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
       exit(1);
     }
   }
 
-  leveldb::g_env = leveldb::Env::Default();
+  if (strcmp(FLAGS_env, "mem") == 0) {
+    if (FLAGS_use_existing_db) {
+      fprintf(stderr, "--use_existing_db has no effect with --env=mem\n");
+      exit(1);
+    }
+    leveldb::g_env = leveldb::NewMemEnv(leveldb::Env::Default());
+  } else {
+    leveldb::g_env = leveldb::Env::Default();
+  }
+
+  if (FLAGS_pin_policy != NULL) {
+    leveldb::ComputePinOrder();
+  }
+  if (FLAGS_numa_membind != NULL) {
+    // Before the DB and its background thread allocate anything
+    leveldb::SetupMemPolicy();
+  }
 
   // Choose a location for the test database if none given with --db=<path>
   if (FLAGS_db == NULL) {
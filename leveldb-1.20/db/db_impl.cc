@@ -98,6 +98,7 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.max_file_size,     1<<20,                       1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.recovery_threads,  1,                           64);
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -362,6 +363,86 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   return Status::OK();
 }
 
+// Log records, and the file they are to be written to, handed by
+// RecoverLogFile() to a recovery job.
+struct DBImpl::RecoveryJob {
+  std::string records;  // Length-prefixed log records
+  FileMetaData meta;
+  Status status;
+  uint64_t micros;
+  bool done;            // Protected by RecoveryPool::mu
+
+  RecoveryJob() : micros(0), done(false) { }
+};
+
+// The threads that run the recovery jobs of a RecoverLogFile() call:
+// at most options_.recovery_threads of them, started as jobs arrive and
+// kept until the pool is closed.
+struct DBImpl::RecoveryPool {
+  DBImpl* db;
+  port::Mutex mu;
+  port::CondVar cv;     // Signalled when any of the state below changes
+  std::deque<RecoveryJob*> queue;  // Jobs not started yet
+  int pending;          // Jobs queued or running
+  int threads;          // Threads started and not exited yet
+  bool closed;          // No more jobs will be queued
+
+  explicit RecoveryPool(DBImpl* d)
+      : db(d), cv(&mu), pending(0), threads(0), closed(false) { }
+};
+
+void DBImpl::RecoveryThread(void* arg) {
+  RecoveryPool* pool = reinterpret_cast<RecoveryPool*>(arg);
+  MutexLock l(&pool->mu);
+  while (true) {
+    while (pool->queue.empty() && !pool->closed) {
+      pool->cv.Wait();
+    }
+    if (pool->queue.empty()) {
+      break;
+    }
+    RecoveryJob* job = pool->queue.front();
+    pool->queue.pop_front();
+    pool->mu.Unlock();
+    pool->db->RunRecoveryJob(job);
+    pool->mu.Lock();
+    job->done = true;
+    pool->pending--;
+    pool->cv.SignalAll();
+  }
+  pool->threads--;
+  pool->cv.SignalAll();
+}
+
+void DBImpl::RunRecoveryJob(RecoveryJob* job) {
+  const uint64_t start_micros = env_->NowMicros();
+  MemTable* mem = new MemTable(internal_comparator_);
+  mem->Ref();
+  Status s;
+  WriteBatch batch;
+  Slice input = job->records;
+  Slice record;
+  while (GetLengthPrefixedSlice(&input, &record)) {
+    WriteBatchInternal::SetContents(&batch, record);
+    s = WriteBatchInternal::InsertInto(&batch, mem);
+    MaybeIgnoreError(&s);
+    if (!s.ok()) {
+      break;
+    }
+  }
+  std::string().swap(job->records);  // Free memory early
+
+  if (s.ok()) {
+    Iterator* iter = mem->NewIterator();
+    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &job->meta);
+    delete iter;
+  }
+  mem->Unref();
+
+  job->status = s;
+  job->micros = env_->NowMicros() - start_micros;
+}
+
 Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
                               bool* save_manifest, VersionEdit* edit,
                               SequenceNumber* max_sequence) {
@@ -404,12 +485,28 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   Log(options_.info_log, "Recovering log #%llu",
       (unsigned long long) log_number);
 
-  // Read all the records and add to a memtable
+  // Read all the records and add to a memtable.  With recovery_threads
+  // > 1, every write_buffer_size bytes worth of records are instead
+  // handed to a recovery job, which inserts them into a memtable of its
+  // own and writes that out as a level-0 table on a thread of the pool.
+  // Jobs cover consecutive ranges of sequence numbers and get increasing
+  // file numbers, so the resulting tables are ordered like ones written
+  // by CompactMemTable().  The records after the last full chunk are
+  // inserted into "mem" right here, since it may become mem_.
+  //
+  // Either way, mutex_ is held except while waiting for tables to be
+  // built: WriteLevel0Table() releases it around BuildTable(), and
+  // SubmitRecoveryJob() and the final wait release it while they wait
+  // for the pool.  Recovery jobs never take mutex_.
+  const bool parallel = options_.recovery_threads > 1;
   std::string scratch;
   Slice record;
   WriteBatch batch;
   int compactions = 0;
   MemTable* mem = NULL;
+  RecoveryPool pool(this);
+  std::vector<RecoveryJob*> jobs;
+  RecoveryJob* job = NULL;
   while (reader.ReadRecord(&record, &scratch) &&
          status.ok()) {
     if (record.size() < 12) {
@@ -418,16 +515,6 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
       continue;
     }
     WriteBatchInternal::SetContents(&batch, record);
-
-    if (mem == NULL) {
-      mem = new MemTable(internal_comparator_);
-      mem->Ref();
-    }
-    status = WriteBatchInternal::InsertInto(&batch, mem);
-    MaybeIgnoreError(&status);
-    if (!status.ok()) {
-      break;
-    }
     const SequenceNumber last_seq =
         WriteBatchInternal::Sequence(&batch) +
         WriteBatchInternal::Count(&batch) - 1;
@@ -435,18 +522,101 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
       *max_sequence = last_seq;
     }
 
-    if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
-      compactions++;
-      *save_manifest = true;
-      status = WriteLevel0Table(mem, edit, NULL);
-      mem->Unref();
-      mem = NULL;
+    if (!parallel) {
+      if (mem == NULL) {
+        mem = new MemTable(internal_comparator_);
+        mem->Ref();
+      }
+      status = WriteBatchInternal::InsertInto(&batch, mem);
+      MaybeIgnoreError(&status);
       if (!status.ok()) {
-        // Reflect errors immediately so that conditions like full
-        // file-systems cause the DB::Open() to fail.
         break;
       }
+      if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
+        compactions++;
+        *save_manifest = true;
+        status = WriteLevel0Table(mem, edit, NULL);
+        mem->Unref();
+        mem = NULL;
+        if (!status.ok()) {
+          // Reflect errors immediately so that conditions like full
+          // file-systems cause the DB::Open() to fail.
+          break;
+        }
+      }
+      continue;
+    }
+
+    if (job == NULL) {
+      job = new RecoveryJob;
+    }
+    PutLengthPrefixedSlice(&job->records, record);
+    if (job->records.size() <= options_.write_buffer_size) {
+      continue;
     }
+
+    compactions++;
+    *save_manifest = true;
+    job->meta.number = versions_->NewFileNumber();
+    pending_outputs_.insert(job->meta.number);
+    jobs.push_back(job);
+    Log(options_.info_log, "Level-0 table #%llu: started",
+        (unsigned long long) job->meta.number);
+    // Reflect errors immediately so that conditions like full
+    // file-systems cause the DB::Open() to fail.
+    status = SubmitRecoveryJob(&pool, job, jobs);
+    job = NULL;
+  }
+
+  if (parallel) {
+    // Wait for the jobs and record their tables in order
+    mutex_.Unlock();
+    pool.mu.Lock();
+    pool.closed = true;
+    pool.cv.SignalAll();
+    while (pool.threads > 0) {
+      pool.cv.Wait();
+    }
+    pool.mu.Unlock();
+    mutex_.Lock();
+  }
+  for (size_t i = 0; i < jobs.size(); i++) {
+    RecoveryJob* j = jobs[i];
+    Log(options_.info_log, "Level-0 table #%llu: %lld bytes %s",
+        (unsigned long long) j->meta.number,
+        (unsigned long long) j->meta.file_size,
+        j->status.ToString().c_str());
+    pending_outputs_.erase(j->meta.number);
+    if (status.ok()) {
+      status = j->status;
+    }
+    if (j->status.ok() && j->meta.file_size > 0) {
+      edit->AddFile(0, j->meta.number, j->meta.file_size,
+                    j->meta.smallest, j->meta.largest);
+    }
+    CompactionStats stats;
+    stats.micros = j->micros;
+    stats.bytes_written = j->meta.file_size;
+    stats_[0].Add(stats);
+    delete j;
+  }
+
+  // Insert the remaining records into a memtable
+  if (job != NULL) {
+    if (status.ok()) {
+      mem = new MemTable(internal_comparator_);
+      mem->Ref();
+      Slice input = job->records;
+      while (GetLengthPrefixedSlice(&input, &record)) {
+        WriteBatchInternal::SetContents(&batch, record);
+        status = WriteBatchInternal::InsertInto(&batch, mem);
+        MaybeIgnoreError(&status);
+        if (!status.ok()) {
+          break;
+        }
+      }
+    }
+    delete job;
   }
 
   delete file;
@@ -458,7 +628,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     assert(mem_ == NULL);
     uint64_t lfile_size;
     if (env_->GetFileSize(fname, &lfile_size).ok() &&
-        env_->NewAppendableFile(fname, &logfile_).ok()) {
+        env_->NewLogFile(fname, true, &logfile_).ok()) {
       Log(options_.info_log, "Reusing old log %s \n", fname.c_str());
       log_ = new log::Writer(logfile_, lfile_size);
       logfile_number_ = log_number;
@@ -485,6 +655,35 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   return status;
 }
 
+Status DBImpl::SubmitRecoveryJob(RecoveryPool* pool, RecoveryJob* job,
+                                 const std::vector<RecoveryJob*>& jobs) {
+  mutex_.AssertHeld();
+  mutex_.Unlock();
+  pool->mu.Lock();
+  // Keep at most recovery_threads jobs, and so chunks of records, in
+  // memory at once
+  while (pool->pending >= options_.recovery_threads) {
+    pool->cv.Wait();
+  }
+  pool->queue.push_back(job);
+  pool->pending++;
+  if (pool->threads < pool->pending) {
+    pool->threads++;
+    env_->StartThread(&DBImpl::RecoveryThread, pool);
+  }
+  pool->cv.SignalAll();
+
+  Status s;
+  for (size_t i = 0; i < jobs.size() && s.ok(); i++) {
+    if (jobs[i]->done) {
+      s = jobs[i]->status;
+    }
+  }
+  pool->mu.Unlock();
+  mutex_.Lock();
+  return s;
+}
+
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
                                 Version* base) {
   mutex_.AssertHeld();
@@ -1356,7 +1555,8 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       assert(versions_->PrevLogNumber() == 0);
       uint64_t new_log_number = versions_->NewFileNumber();
       WritableFile* lfile = NULL;
-      s = env_->NewWritableFile(LogFileName(dbname_, new_log_number), &lfile);
+      s = env_->NewLogFile(LogFileName(dbname_, new_log_number), false,
+                           &lfile);
       if (!s.ok()) {
         // Avoid chewing through file number space in a tight loop.
         versions_->ReuseFileNumber(new_log_number);
@@ -1501,8 +1701,8 @@ Status DB::Open(const Options& options, const std::string& dbname,
     // Create new log and a corresponding memtable.
     uint64_t new_log_number = impl->versions_->NewFileNumber();
     WritableFile* lfile;
-    s = options.env->NewWritableFile(LogFileName(dbname, new_log_number),
-                                     &lfile);
+    s = options.env->NewLogFile(LogFileName(dbname, new_log_number), false,
+                                &lfile);
     if (s.ok()) {
       edit.SetLogNumber(new_log_number);
       impl->logfile_ = lfile;
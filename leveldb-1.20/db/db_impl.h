@@ -7,6 +7,7 @@
 
 #include <deque>
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
@@ -68,6 +69,8 @@ class DBImpl : public DB {
   friend class DB;
   struct CompactionState;
   struct Writer;
+  struct RecoveryJob;
+  struct RecoveryPool;
 
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot,
@@ -98,6 +101,18 @@ class DBImpl : public DB {
   Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Queue "job" on "pool", waiting while recovery_threads jobs are
+  // pending, and return the first error of the finished "jobs".
+  // Releases mutex_ while it waits.
+  Status SubmitRecoveryJob(RecoveryPool* pool, RecoveryJob* job,
+                           const std::vector<RecoveryJob*>& jobs)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Build the level-0 table of a chunk of recovered log records.
+  // Runs without mutex_ on a thread of the recovery pool.
+  void RunRecoveryJob(RecoveryJob* job);
+  static void RecoveryThread(void* pool);
+
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
@@ -196,6 +196,7 @@ class DBTest {
     kReuse,
     kFilter,
     kUncompressed,
+    kMetadataCache,
     kEnd
   };
   int option_config_;
@@ -249,6 +250,10 @@ class DBTest {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kMetadataCache:
+        options.filter_policy = filter_policy_;
+        options.metadata_cache_size = 1 << 20;
+        break;
       default:
         break;
     }
@@ -634,6 +639,59 @@ TEST(DBTest, GetPicksCorrectFile) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, MetadataCacheOutlivesTableCache) {
+  const FilterPolicy* policy = NewBloomFilterPolicy(10);
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.filter_policy = policy;
+  options.metadata_cache_size = 1 << 20;
+  options.block_cache = NewLRUCache(0);  // Count every data block read
+  options.max_open_files = 0;  // Clipped to the smallest table cache
+  Reopen(&options);
+
+  // Create more non-overlapping tables than the table cache can hold
+  const int kNumTables = 100;
+  char key[20];
+  for (int i = 0; i < kNumTables; i++) {
+    snprintf(key, sizeof(key), "key%06d", i);
+    ASSERT_OK(Put(key, key));
+    dbfull()->TEST_CompactMemTable();
+  }
+  ASSERT_EQ(kNumTables, TotalTableFiles());
+
+  // Reading every table in turn evicts each one from the table cache
+  // before it is read again.  The tables are then reopened with their
+  // index and filter blocks from the metadata cache, so a present key
+  // only reads its data block; without the metadata cache, every reopen
+  // would also read the footer, index, metaindex and filter blocks.
+  // Missing keys are answered by the filter of the open table.
+  for (int round = 0; round < 3; round++) {
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < kNumTables; i++) {
+      snprintf(key, sizeof(key), "key%06d", i);
+      ASSERT_EQ(key, Get(key));
+    }
+    const int present_reads = env_->random_read_counter_.Read();
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < kNumTables; i++) {
+      snprintf(key, sizeof(key), "key%06d.x", i);
+      ASSERT_EQ("NOT_FOUND", Get(key));
+    }
+    const int missing_reads = env_->random_read_counter_.Read();
+    fprintf(stderr, "round %d: %d present => %d reads, "
+            "%d missing => %d reads\n", round,
+            kNumTables, present_reads, kNumTables, missing_reads);
+    if (round > 0) {
+      ASSERT_EQ(kNumTables, present_reads);
+      ASSERT_LE(missing_reads, 5);
+    }
+  }
+  Close();
+  delete options.block_cache;
+  delete policy;
+}
+
 TEST(DBTest, GetEncountersEmptyLevel) {
   do {
     // Arrange for the following to happen:
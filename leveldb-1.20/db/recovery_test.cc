@@ -271,6 +271,36 @@ TEST(RecoveryTest, MultipleMemTables) {
   }
 }
 
+TEST(RecoveryTest, ParallelMemTables) {
+  // Overwrite every key several times so that later memtables of the
+  // log shadow earlier ones.
+  const int kNum = 1000;
+  const int kRounds = 8;
+  for (int r = 0; r < kRounds; r++) {
+    for (int i = 0; i < kNum; i++) {
+      char key[100], value[100];
+      snprintf(key, sizeof(key), "%050d", i);
+      snprintf(value, sizeof(value), "%050d", r * kNum + i);
+      ASSERT_OK(Put(key, value));
+    }
+  }
+  Close();
+  ASSERT_EQ(0, NumTables());
+  ASSERT_EQ(1, NumLogs());
+
+  Options opt;
+  opt.write_buffer_size = 64 << 10;
+  opt.recovery_threads = 4;
+  Open(&opt);
+  ASSERT_LE(6, NumTables());
+  for (int i = 0; i < kNum; i++) {
+    char key[100], value[100];
+    snprintf(key, sizeof(key), "%050d", i);
+    snprintf(value, sizeof(value), "%050d", (kRounds - 1) * kNum + i);
+    ASSERT_EQ(value, Get(key));
+  }
+}
+
 TEST(RecoveryTest, MultipleLogFiles) {
   ASSERT_OK(Put("foo", "bar"));
   Close();
@@ -8,6 +8,7 @@
 #include "leveldb/env.h"
 #include "leveldb/table.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
@@ -35,11 +36,27 @@ TableCache::TableCache(const std::string& dbname,
     : env_(options->env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {
+      cache_(NewLRUCache(entries)),
+      meta_cache_(options->metadata_cache_size > 0
+                  ? NewLRUCache(options->metadata_cache_size) : NULL),
+      preload_cv_(&mu_),
+      preloader_running_(false),
+      shutting_down_(false),
+      preloading_(0),
+      preload_evicted_(false) {
 }
 
 TableCache::~TableCache() {
+  mu_.Lock();
+  shutting_down_ = true;
+  preload_queue_.clear();
+  while (preloader_running_) {
+    preload_cv_.Wait();
+  }
+  mu_.Unlock();
+
   delete cache_;
+  delete meta_cache_;
 }
 
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
@@ -50,26 +67,10 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
   Slice key(buf, sizeof(buf));
   *handle = cache_->Lookup(key);
   if (*handle == NULL) {
-    std::string fname = TableFileName(dbname_, file_number);
     RandomAccessFile* file = NULL;
     Table* table = NULL;
-    s = env_->NewRandomAccessFile(fname, &file);
-    if (!s.ok()) {
-      std::string old_fname = SSTTableFileName(dbname_, file_number);
-      if (env_->NewRandomAccessFile(old_fname, &file).ok()) {
-        s = Status::OK();
-      }
-    }
+    s = OpenTable(file_number, file_size, key, &file, &table);
     if (s.ok()) {
-      s = Table::Open(*options_, file, file_size, &table);
-    }
-
-    if (!s.ok()) {
-      assert(table == NULL);
-      delete file;
-      // We do not cache error results so that if the error is transient,
-      // or somebody repairs the file, we recover automatically.
-    } else {
       TableAndFile* tf = new TableAndFile;
       tf->file = file;
       tf->table = table;
@@ -79,6 +80,33 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
   return s;
 }
 
+Status TableCache::OpenTable(uint64_t file_number, uint64_t file_size,
+                             const Slice& key,
+                             RandomAccessFile** file, Table** table) {
+  std::string fname = TableFileName(dbname_, file_number);
+  *file = NULL;
+  *table = NULL;
+  Status s = env_->NewRandomAccessFile(fname, file);
+  if (!s.ok()) {
+    std::string old_fname = SSTTableFileName(dbname_, file_number);
+    if (env_->NewRandomAccessFile(old_fname, file).ok()) {
+      s = Status::OK();
+    }
+  }
+  if (s.ok()) {
+    s = Table::Open(*options_, *file, file_size, meta_cache_, key, table);
+  }
+
+  if (!s.ok()) {
+    assert(*table == NULL);
+    delete *file;
+    *file = NULL;
+    // We do not cache error results so that if the error is transient,
+    // or somebody repairs the file, we recover automatically.
+  }
+  return s;
+}
+
 Iterator* TableCache::NewIterator(const ReadOptions& options,
                                   uint64_t file_number,
                                   uint64_t file_size,
@@ -121,7 +149,85 @@ Status TableCache::Get(const ReadOptions& options,
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
+  // Hold mu_ so that the preloader cannot put the file back (see
+  // BackgroundPreload)
+  MutexLock l(&mu_);
+  for (std::deque<std::pair<uint64_t, uint64_t> >::iterator it =
+           preload_queue_.begin();
+       it != preload_queue_.end(); ) {
+    if (it->first == file_number) {
+      it = preload_queue_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (preloading_ == file_number) {
+    preload_evicted_ = true;
+  }
   cache_->Erase(Slice(buf, sizeof(buf)));
+  if (meta_cache_ != NULL) {
+    meta_cache_->Erase(Slice(buf, sizeof(buf)));
+  }
+}
+
+void TableCache::Preload(uint64_t file_number, uint64_t file_size) {
+  if (meta_cache_ == NULL) {
+    return;
+  }
+  MutexLock l(&mu_);
+  if (shutting_down_) {
+    return;
+  }
+  preload_queue_.push_back(std::make_pair(file_number, file_size));
+  if (!preloader_running_) {
+    preloader_running_ = true;
+    env_->StartThread(&TableCache::PreloadWork, this);
+  }
+}
+
+void TableCache::PreloadWork(void* table_cache) {
+  reinterpret_cast<TableCache*>(table_cache)->BackgroundPreload();
+}
+
+void TableCache::BackgroundPreload() {
+  MutexLock l(&mu_);
+  while (!preload_queue_.empty()) {
+    std::pair<uint64_t, uint64_t> f = preload_queue_.front();
+    preload_queue_.pop_front();
+    preloading_ = f.first;
+    preload_evicted_ = false;
+    mu_.Unlock();
+
+    char buf[sizeof(f.first)];
+    EncodeFixed64(buf, f.first);
+    Slice key(buf, sizeof(buf));
+    Cache::Handle* handle = cache_->Lookup(key);
+    RandomAccessFile* file = NULL;
+    Table* table = NULL;
+    // Errors will be reported again by the read that needs the file
+    const bool opened = (handle == NULL) &&
+        OpenTable(f.first, f.second, key, &file, &table).ok();
+
+    mu_.Lock();
+    if (handle != NULL) {
+      cache_->Release(handle);
+    } else if (opened) {
+      if (preload_evicted_) {
+        // The file was deleted while we opened it: do not cache it again
+        delete table;
+        delete file;
+        meta_cache_->Erase(key);
+      } else {
+        TableAndFile* tf = new TableAndFile;
+        tf->file = file;
+        tf->table = table;
+        cache_->Release(cache_->Insert(key, tf, 1, &DeleteEntry));
+      }
+    }
+    preloading_ = 0;
+  }
+  preloader_running_ = false;
+  preload_cv_.SignalAll();
 }
 
 }  // namespace leveldb
@@ -7,7 +7,9 @@
 #ifndef STORAGE_LEVELDB_DB_TABLE_CACHE_H_
 #define STORAGE_LEVELDB_DB_TABLE_CACHE_H_
 
+#include <deque>
 #include <string>
+#include <utility>
 #include <stdint.h>
 #include "db/dbformat.h"
 #include "leveldb/cache.h"
@@ -47,13 +49,35 @@ class TableCache {
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
+  // Open the specified file on a background thread, so that its index
+  // and filter blocks are in the metadata cache before the first read
+  // of the file needs them.  Does nothing unless
+  // options->metadata_cache_size is non-zero.
+  void Preload(uint64_t file_number, uint64_t file_size);
+
  private:
   Env* const env_;
   const std::string dbname_;
   const Options* options_;
   Cache* cache_;
+  Cache* meta_cache_;  // LRU of index/filter blocks, NULL if
+                       // options->metadata_cache_size == 0
+
+  // State below is protected by mu_
+  port::Mutex mu_;
+  port::CondVar preload_cv_;  // Signalled when the preloader exits
+  std::deque<std::pair<uint64_t, uint64_t> > preload_queue_;
+  bool preloader_running_;
+  bool shutting_down_;
+  uint64_t preloading_;   // File the preloader is opening, 0 if none
+  bool preload_evicted_;  // Was "preloading_" evicted while being opened?
 
   Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
+  Status OpenTable(uint64_t file_number, uint64_t file_size, const Slice& key,
+                   RandomAccessFile** file, Table** table);
+
+  static void PreloadWork(void* table_cache);
+  void BackgroundPreload();
 };
 
 }  // namespace leveldb
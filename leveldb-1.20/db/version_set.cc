@@ -888,6 +888,12 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     AppendVersion(v);
     log_number_ = edit->log_number_;
     prev_log_number_ = edit->prev_log_number_;
+
+    // Get the metadata of the new tables loaded before reads need it
+    for (size_t i = 0; i < edit->new_files_.size(); i++) {
+      const FileMetaData& f = edit->new_files_[i].second;
+      table_cache_->Preload(f.number, f.file_size);
+    }
   } else {
     delete v;
     if (!new_manifest_file.empty()) {
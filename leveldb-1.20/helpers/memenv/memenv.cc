@@ -7,6 +7,7 @@
 #include "leveldb/env.h"
 #include "leveldb/status.h"
 #include "port/port.h"
+#include "util/hash.h"
 #include "util/mutexlock.h"
 #include <map>
 #include <string.h>
@@ -232,46 +233,52 @@ class InMemoryEnv : public EnvWrapper {
   explicit InMemoryEnv(Env* base_env) : EnvWrapper(base_env) { }
 
   virtual ~InMemoryEnv() {
-    for (FileSystem::iterator i = file_map_.begin(); i != file_map_.end(); ++i){
-      i->second->Unref();
+    for (int s = 0; s < kNumShards; s++) {
+      FileSystem* files = &shards_[s].files;
+      for (FileSystem::iterator i = files->begin(); i != files->end(); ++i) {
+        i->second->Unref();
+      }
     }
   }
 
   // Partial implementation of the Env interface.
   virtual Status NewSequentialFile(const std::string& fname,
                                    SequentialFile** result) {
-    MutexLock lock(&mutex_);
-    if (file_map_.find(fname) == file_map_.end()) {
+    Shard* shard = ShardFor(fname);
+    MutexLock lock(&shard->mutex);
+    FileSystem::iterator it = shard->files.find(fname);
+    if (it == shard->files.end()) {
       *result = NULL;
       return Status::IOError(fname, "File not found");
     }
 
-    *result = new SequentialFileImpl(file_map_[fname]);
+    *result = new SequentialFileImpl(it->second);
     return Status::OK();
   }
 
   virtual Status NewRandomAccessFile(const std::string& fname,
                                      RandomAccessFile** result) {
-    MutexLock lock(&mutex_);
-    if (file_map_.find(fname) == file_map_.end()) {
+    Shard* shard = ShardFor(fname);
+    MutexLock lock(&shard->mutex);
+    FileSystem::iterator it = shard->files.find(fname);
+    if (it == shard->files.end()) {
       *result = NULL;
       return Status::IOError(fname, "File not found");
     }
 
-    *result = new RandomAccessFileImpl(file_map_[fname]);
+    *result = new RandomAccessFileImpl(it->second);
     return Status::OK();
   }
 
   virtual Status NewWritableFile(const std::string& fname,
                                  WritableFile** result) {
-    MutexLock lock(&mutex_);
-    if (file_map_.find(fname) != file_map_.end()) {
-      DeleteFileInternal(fname);
-    }
+    Shard* shard = ShardFor(fname);
+    MutexLock lock(&shard->mutex);
+    DeleteFileInternal(shard, fname);
 
     FileState* file = new FileState();
     file->Ref();
-    file_map_[fname] = file;
+    shard->files[fname] = file;
 
     *result = new WritableFileImpl(file);
     return Status::OK();
@@ -279,55 +286,55 @@ class InMemoryEnv : public EnvWrapper {
 
   virtual Status NewAppendableFile(const std::string& fname,
                                    WritableFile** result) {
-    MutexLock lock(&mutex_);
-    FileState** sptr = &file_map_[fname];
+    Shard* shard = ShardFor(fname);
+    MutexLock lock(&shard->mutex);
+    FileState** sptr = &shard->files[fname];
     FileState* file = *sptr;
     if (file == NULL) {
       file = new FileState();
       file->Ref();
+      *sptr = file;
     }
     *result = new WritableFileImpl(file);
     return Status::OK();
   }
 
   virtual bool FileExists(const std::string& fname) {
-    MutexLock lock(&mutex_);
-    return file_map_.find(fname) != file_map_.end();
+    Shard* shard = ShardFor(fname);
+    MutexLock lock(&shard->mutex);
+    return shard->files.find(fname) != shard->files.end();
   }
 
   virtual Status GetChildren(const std::string& dir,
                              std::vector<std::string>* result) {
-    MutexLock lock(&mutex_);
     result->clear();
 
-    for (FileSystem::iterator i = file_map_.begin(); i != file_map_.end(); ++i){
-      const std::string& filename = i->first;
-
-      if (filename.size() >= dir.size() + 1 && filename[dir.size()] == '/' &&
-          Slice(filename).starts_with(Slice(dir))) {
-        result->push_back(filename.substr(dir.size() + 1));
+    // Not atomic across shards, which is no weaker than a real directory
+    // listing racing with file creation.
+    for (int s = 0; s < kNumShards; s++) {
+      MutexLock lock(&shards_[s].mutex);
+      const FileSystem& files = shards_[s].files;
+      for (FileSystem::const_iterator i = files.begin(); i != files.end();
+           ++i) {
+        const std::string& filename = i->first;
+
+        if (filename.size() >= dir.size() + 1 &&
+            filename[dir.size()] == '/' &&
+            Slice(filename).starts_with(Slice(dir))) {
+          result->push_back(filename.substr(dir.size() + 1));
+        }
       }
     }
 
     return Status::OK();
   }
 
-  void DeleteFileInternal(const std::string& fname) {
-    if (file_map_.find(fname) == file_map_.end()) {
-      return;
-    }
-
-    file_map_[fname]->Unref();
-    file_map_.erase(fname);
-  }
-
   virtual Status DeleteFile(const std::string& fname) {
-    MutexLock lock(&mutex_);
-    if (file_map_.find(fname) == file_map_.end()) {
+    Shard* shard = ShardFor(fname);
+    MutexLock lock(&shard->mutex);
+    if (!DeleteFileInternal(shard, fname)) {
       return Status::IOError(fname, "File not found");
     }
-
-    DeleteFileInternal(fname);
     return Status::OK();
   }
 
@@ -340,26 +347,42 @@ class InMemoryEnv : public EnvWrapper {
   }
 
   virtual Status GetFileSize(const std::string& fname, uint64_t* file_size) {
-    MutexLock lock(&mutex_);
-    if (file_map_.find(fname) == file_map_.end()) {
+    Shard* shard = ShardFor(fname);
+    MutexLock lock(&shard->mutex);
+    FileSystem::iterator it = shard->files.find(fname);
+    if (it == shard->files.end()) {
       return Status::IOError(fname, "File not found");
     }
 
-    *file_size = file_map_[fname]->Size();
+    *file_size = it->second->Size();
     return Status::OK();
   }
 
   virtual Status RenameFile(const std::string& src,
                             const std::string& target) {
-    MutexLock lock(&mutex_);
-    if (file_map_.find(src) == file_map_.end()) {
-      return Status::IOError(src, "File not found");
+    Shard* src_shard = ShardFor(src);
+    Shard* target_shard = ShardFor(target);
+
+    // Lock both shards in address order so that concurrent renames in
+    // opposite directions cannot deadlock.
+    Shard* first = src_shard < target_shard ? src_shard : target_shard;
+    Shard* second = src_shard < target_shard ? target_shard : src_shard;
+    MutexLock l1(&first->mutex);
+    if (second != first) second->mutex.Lock();
+
+    Status s;
+    FileSystem::iterator it = src_shard->files.find(src);
+    if (it == src_shard->files.end()) {
+      s = Status::IOError(src, "File not found");
+    } else {
+      FileState* file = it->second;
+      src_shard->files.erase(it);
+      DeleteFileInternal(target_shard, target);
+      target_shard->files[target] = file;
     }
 
-    DeleteFileInternal(target);
-    file_map_[target] = file_map_[src];
-    file_map_.erase(src);
-    return Status::OK();
+    if (second != first) second->mutex.Unlock();
+    return s;
   }
 
   virtual Status LockFile(const std::string& fname, FileLock** lock) {
@@ -385,8 +408,35 @@ class InMemoryEnv : public EnvWrapper {
  private:
   // Map from filenames to FileState objects, representing a simple file system.
   typedef std::map<std::string, FileState*> FileSystem;
-  port::Mutex mutex_;
-  FileSystem file_map_;  // Protected by mutex_.
+
+  // The file system is split by file name hash into shards with their own
+  // mutex, so that threads opening different files (e.g. table cache
+  // misses) do not all serialize on one lock.
+  enum { kNumShards = 16 };
+
+  struct Shard {
+    port::Mutex mutex;
+    FileSystem files;  // Protected by mutex.
+  };
+
+  Shard shards_[kNumShards];
+
+  Shard* ShardFor(const std::string& fname) {
+    return &shards_[Hash(fname.data(), fname.size(), 0) % kNumShards];
+  }
+
+  // Returns false if there was no such file.
+  // REQUIRES: shard->mutex is held
+  bool DeleteFileInternal(Shard* shard, const std::string& fname) {
+    FileSystem::iterator it = shard->files.find(fname);
+    if (it == shard->files.end()) {
+      return false;
+    }
+
+    it->second->Unref();
+    shard->files.erase(it);
+    return true;
+  }
 };
 
 }  // namespace
@@ -93,6 +93,57 @@ TEST(MemEnvTest, Basics) {
   ASSERT_OK(env_->DeleteDir("/dir"));
 }
 
+TEST(MemEnvTest, ManyFiles) {
+  // Enough files to land in every shard of the file system
+  const int kNumFiles = 200;
+  uint64_t file_size;
+  WritableFile* writable_file;
+  std::vector<std::string> children;
+  char name[100];
+
+  for (int i = 0; i < kNumFiles; i++) {
+    snprintf(name, sizeof(name), "/dir/%d", i);
+    ASSERT_OK(env_->NewWritableFile(name, &writable_file));
+    ASSERT_OK(writable_file->Append(std::string(i, 'x')));
+    delete writable_file;
+  }
+  ASSERT_OK(env_->NewWritableFile("/other/f", &writable_file));
+  delete writable_file;
+  ASSERT_OK(env_->GetChildren("/dir", &children));
+  ASSERT_EQ(kNumFiles, children.size());
+
+  // Renames move files between shards
+  for (int i = 0; i < kNumFiles; i++) {
+    char target[100];
+    snprintf(name, sizeof(name), "/dir/%d", i);
+    snprintf(target, sizeof(target), "/dir/renamed-%d", i);
+    ASSERT_OK(env_->RenameFile(name, target));
+    ASSERT_TRUE(!env_->FileExists(name));
+    ASSERT_OK(env_->GetFileSize(target, &file_size));
+    ASSERT_EQ(i, file_size);
+  }
+  ASSERT_OK(env_->GetChildren("/dir", &children));
+  ASSERT_EQ(kNumFiles, children.size());
+
+  // Renaming onto an existing file replaces it
+  ASSERT_OK(env_->RenameFile("/dir/renamed-1", "/dir/renamed-2"));
+  ASSERT_OK(env_->GetFileSize("/dir/renamed-2", &file_size));
+  ASSERT_EQ(1, file_size);
+  ASSERT_OK(env_->GetChildren("/dir", &children));
+  ASSERT_EQ(kNumFiles - 1, children.size());
+}
+
+TEST(MemEnvTest, NewAppendableFileCreates) {
+  uint64_t file_size;
+  WritableFile* writable_file;
+  ASSERT_OK(env_->NewAppendableFile("/dir/new", &writable_file));
+  ASSERT_OK(writable_file->Append("hello"));
+  delete writable_file;
+  ASSERT_TRUE(env_->FileExists("/dir/new"));
+  ASSERT_OK(env_->GetFileSize("/dir/new", &file_size));
+  ASSERT_EQ(5, file_size);
+}
+
 TEST(MemEnvTest, ReadWrite) {
   WritableFile* writable_file;
   SequentialFile* seq_file;
@@ -88,6 +88,19 @@ class Cache {
   // leveldb may change Prune() to a pure abstract method.
   virtual void Prune() {}
 
+  // Return true iff the cache has a mapping for "key".  Unlike Lookup(),
+  // this is a hint that must not count as a use of the entry.  The
+  // default implementation does count it; subclasses are encouraged to
+  // override it.
+  virtual bool Contains(const Slice& key) {
+    Handle* h = Lookup(key);
+    if (h == NULL) {
+      return false;
+    }
+    Release(h);
+    return true;
+  }
+
   // Return an estimate of the combined charges of all elements stored in the
   // cache.
   virtual size_t TotalCharge() const = 0;
@@ -84,6 +84,17 @@ class Env {
   virtual Status NewAppendableFile(const std::string& fname,
                                    WritableFile** result);
 
+  // Like NewWritableFile(), or NewAppendableFile() if "append" is true,
+  // for a write-ahead log file, which is only ever appended to and
+  // synced.  An Env may return a file tuned for that pattern.  The
+  // default implementation calls NewWritableFile() or
+  // NewAppendableFile().
+  //
+  // EnvWrapper does not forward this call, so that wrappers that
+  // intercept NewWritableFile() also see the log files.
+  virtual Status NewLogFile(const std::string& fname, bool append,
+                            WritableFile** result);
+
   // Returns true iff the named file exists.
   virtual bool FileExists(const std::string& fname) = 0;
 
@@ -200,6 +211,15 @@ class SequentialFile {
   void operator=(const SequentialFile&);
 };
 
+// One read issued through RandomAccessFile::MultiRead().
+struct ReadRequest {
+  uint64_t offset;   // Input: file offset of the first byte to read
+  size_t n;          // Input: number of bytes to read
+  char* scratch;     // Input: buffer of at least "n" bytes
+  Slice result;      // Output: bytes read (may point into "scratch")
+  Status status;     // Output: status of this particular read
+};
+
 // A file abstraction for randomly reading the contents of a file.
 class RandomAccessFile {
  public:
@@ -218,6 +238,16 @@ class RandomAccessFile {
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
 
+  // Perform the reads described by reqs[0..num-1].  Each request is
+  // handled as if by Read(reqs[i].offset, reqs[i].n, &reqs[i].result,
+  // reqs[i].scratch), with its outcome stored in reqs[i].status.
+  // Implementations may issue the reads concurrently; the default
+  // implementation performs them one after the other.  Returns OK iff
+  // every request succeeded, and otherwise the first non-OK status.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual Status MultiRead(ReadRequest* reqs, size_t num) const;
+
  private:
   // No copying allowed
   RandomAccessFile(const RandomAccessFile&);
@@ -97,6 +97,16 @@ struct Options {
   // Default: NULL
   Cache* block_cache;
 
+  // If non-zero, the index and filter blocks of table files are also
+  // kept in a separate LRU cache of this many bytes.  They then stay in
+  // memory when the table itself is evicted from the set of open files
+  // (see max_open_files), and are loaded in the background as soon as
+  // a compaction installs a new table, so that reads do not have to
+  // load them.  They are not pinned: when the cache is full, the least
+  // recently used tables lose their blocks and reload them on demand.
+  // Default: 0
+  size_t metadata_cache_size;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -146,6 +156,16 @@ struct Options {
   // Default: currently false, but may become true later.
   bool reuse_logs;
 
+  // Number of threads that turn the records of a log file into level-0
+  // tables while the database is being recovered.  Each thread holds
+  // about twice write_buffer_size bytes of memory.  1 recovers the log
+  // on the opening thread alone, as earlier releases did.  Larger values
+  // split the log into chunks of write_buffer_size bytes of records, so
+  // the level-0 tables may be laid out differently.
+  //
+  // Default: 1
+  int recovery_threads;
+
   // If non-NULL, use the specified filter policy to reduce disk reads.
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
@@ -166,6 +186,8 @@ struct ReadOptions {
 
   // Should the data read for this iteration be cached in memory?
   // Callers may wish to set this field to false for bulk scans.
+  // Iterators created with fill_cache == false also read ahead of
+  // sequential scans, several data blocks per read.
   // Default: true
   bool fill_cache;
 
@@ -12,6 +12,8 @@ namespace leveldb {
 
 class Block;
 class BlockHandle;
+class Cache;
+struct BlockContents;
 class Footer;
 struct Options;
 class RandomAccessFile;
@@ -59,8 +61,24 @@ class Table {
   struct Rep;
   Rep* rep_;
 
+  // Per-iterator readahead state for sequential scans
+  struct ScanState;
+
   explicit Table(Rep* rep) { rep_ = rep; }
+
+  // Like the public Open(), but if "meta_cache" is non-NULL, the index
+  // and filter blocks are looked up in it under "meta_key" before being
+  // read, and inserted into it after having been read.  Used by
+  // TableCache so that they survive eviction of the Table.
+  static Status Open(const Options& options,
+                     RandomAccessFile* file,
+                     uint64_t file_size,
+                     Cache* meta_cache,
+                     const Slice& meta_key,
+                     Table** table);
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
+  static Iterator* ScanBlockReader(void*, const ReadOptions&, const Slice&);
+  static void DeleteScanState(void*, void*);
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
@@ -72,7 +90,7 @@ class Table {
       void (*handle_result)(void* arg, const Slice& k, const Slice& v));
 
 
-  void ReadMeta(const Footer& footer);
+  void ReadMeta(const BlockContents& metaindex_contents);
   void ReadFilter(const Slice& filter_handle_value);
 
   // No copying allowed
@@ -36,6 +36,12 @@ class Mutex {
   // REQUIRES: This mutex was locked by this thread.
   void Unlock();
 
+  // Call (*fn)(arg) with the mutex held and return its result.
+  // The implementation may run fn on another thread that holds the
+  // mutex, so fn must not depend on the calling thread nor wait on
+  // a CondVar.
+  void* Run(void* (*fn)(void*), void* arg);
+
   // Optionally crash if this thread does not hold this mutex.
   // The implementation must be fast, especially if NDEBUG is
   // defined.  The implementation is allowed to skip all checks.
@@ -8,6 +8,10 @@
 #include <stdio.h>
 #include <string.h>
 
+// Provided by LiTL (userspace/litl/include/litl.h) when it is preloaded.
+extern "C" void* litl_delegate(pthread_mutex_t* mutex, void* (*fn)(void*),
+                               void* arg) __attribute__((weak));
+
 namespace leveldb {
 namespace port {
 
@@ -26,6 +30,16 @@ void Mutex::Lock() { PthreadCall("lock", pthread_mutex_lock(&mu_)); }
 
 void Mutex::Unlock() { PthreadCall("unlock", pthread_mutex_unlock(&mu_)); }
 
+void* Mutex::Run(void* (*fn)(void*), void* arg) {
+  if (litl_delegate != NULL) {
+    return litl_delegate(&mu_, fn, arg);
+  }
+  Lock();
+  void* result = (*fn)(arg);
+  Unlock();
+  return result;
+}
+
 CondVar::CondVar(Mutex* mu)
     : mu_(mu) {
     PthreadCall("init cv", pthread_cond_init(&cv_, NULL));
@@ -88,6 +88,10 @@ class Mutex {
   void Unlock();
   void AssertHeld() { }
 
+  // Run (*fn)(arg) with the mutex held and return its result.  When the
+  // lock library supports delegation, fn may run on another thread.
+  void* Run(void* (*fn)(void*), void* arg);
+
  private:
   friend class CondVar;
   pthread_mutex_t mu_;
@@ -1,52 +1,184 @@
 #!/bin/bash
+#
+# Run db_bench for every combination of lock, thread count and workload
+# and print one CSV table with the mean and standard deviation over the
+# repetitions.
+#
+# Usage: ./run_db_bench.sh [-l "stock libmcs_spinlock.sh ..."] [-t "1 2 4 8"]
+#                          [-w "readrandom ycsbb ..."] [-r repetitions]
+#                          [-n keys] [-d ms] [-m | -M] [-D db_path]
+#                          [-R raw.csv] [-L log_dir] [-- db_bench options]
+#
+#   -l  locks: "stock" (the plain pthread mutex) or LiTL scripts, looked up
+#       in ../userspace/litl unless given with a path (default: stock and
+#       every built LiTL lock)
+#   -t  thread counts (default: powers of two up to nproc, and nproc)
+#   -w  db_bench benchmarks run against the prepared DB (default readrandom)
+#   -r  repetitions of every run (default 3)
+#   -n  number of keys loaded with fillseq (default 1000000)
+#   -d  duration of every run in milliseconds (default 10000)
+#   -m  keep the DB files in memory (/dev/shm); no root needed
+#   -M  keep the DB in db_bench's in-memory Env (--env=mem): no file system
+#       at all, but the keys are loaded again by every run
+#   -D  directory the DBs are kept in, in a new bench.XXXXXX directory that
+#       is removed at exit; nothing else in it is touched (default /tmp)
+#   -R  also write one CSV row per run to this file
+#   -L  keep the full db_bench output of every run in this directory
+#
+# Unless -M is given, the DB is loaded once and every run starts from a
+# copy of it, so workloads that write do not affect the following runs.
+# A run that does not finish within TIMEOUT seconds (default: duration +
+# 120) is reported on stderr and left out of the table.
 
-source ../../defaults.sh 
+set -o pipefail
 
-cnt=${ncores}
+BASE=$(cd "$(dirname "$0")" && pwd)
+LITL=$(cd "$BASE/../userspace/litl" && pwd)
+DB_BENCH=$BASE/out-static/db_bench
 
-parent_folder=${results_dir}/leveldb
-result_dir=${parent_folder}/${kernel}-${cnt}
-DB_BENCH=./out-static/db_bench
-DB_PATH=/tmp/db
+LOCKS=""
+THREADS=""
+WORKLOADS="readrandom"
+REPS=3
+NUM=1000000
+DURATION=10000
+DB_PATH=/tmp
+RAW=""
+LOG_DIR=""
+MEMENV=0
 
-litl_path=../../userspace/litl/
+while getopts "l:t:w:r:n:d:mMD:R:L:" opt; do
+    case $opt in
+    l) LOCKS=$OPTARG ;;
+    t) THREADS=$OPTARG ;;
+    w) WORKLOADS=$OPTARG ;;
+    r) REPS=$OPTARG ;;
+    n) NUM=$OPTARG ;;
+    d) DURATION=$OPTARG ;;
+    m) DB_PATH=/dev/shm ;;
+    M) MEMENV=1 ;;
+    D) DB_PATH=$OPTARG ;;
+    R) RAW=$OPTARG ;;
+    L) LOG_DIR=$OPTARG ;;
+    *) sed -n '3,30p' "$0" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+TIMEOUT=${TIMEOUT:-$((DURATION / 1000 + 120))}
 
-litl_lock=("" ${litl_path}/libaqswonode_spinlock.sh ${litl_path}/libkomb_spinlock.sh)
-lock_name=(stock shfllock komb)
+if [ ! -x "$DB_BENCH" ]; then
+    make -C "$BASE" -j"$(nproc)" out-static/db_bench >&2 || exit 1
+fi
 
-#Build if DB_BENCH does not exist
-if [ ! -f $DB_BENCH ]; then
-	cd jemalloc/
-	./autogen.sh
-	./configure --without-export --disable-libdl
-	make -j`nproc`
-	cd ../
+if [ -z "$LOCKS" ]; then
+    LOCKS="stock"
+    for l in "$LITL"/lib*.sh; do
+        [ -e "$LITL/lib/$(basename "$l" .sh).so" ] &&
+            LOCKS="$LOCKS $(basename "$l")"
+    done
+fi
 
-	./build_detect_platform build_config.mk .
-	make -j`nproc`
+if [ -z "$THREADS" ]; then
+    n=$(nproc)
+    t=1
+    while [ $t -lt $n ]; do
+        THREADS="$THREADS $t"
+        t=$((t * 2))
+    done
+    THREADS="$THREADS $n"
 fi
 
-# Create result directory
-mkdir -p ${DB_PATH}
-
-for ((i=0;i<${#lock_name[@]};i++))
-do
-for c in ${cores[@]}
-do
-	lock=${litl_lock[$i]}
-	echo ${lock} ${c}
-	result_dir=${parent_folder}/${lock_name[$i]}-${cnt}
-	mkdir -p $result_dir
-	sudo mount -t tmpfs -o size=10G tmpfs $DB_PATH
-	# Create DB with db_bench
-	$DB_BENCH --db=$DB_PATH --benchmarks=fillseq --threads=1
-	# sync
-	echo $c
-
-	taskset -c 0-$(($c-1)) $lock $DB_BENCH --pin_threads=1 --benchmarks=readrandom --use_existing_db=1 --db=$DB_PATH --threads=$c --time_ms=30000 | tee $result_dir/readrandom.$c
-
-	sudo rm -rf $DB_PATH/*
-	sudo umount $DB_PATH
-	sleep 5
-done
+[ -n "$LOG_DIR" ] && mkdir -p "$LOG_DIR"
+
+RUNS=$(mktemp)
+if [ $MEMENV -eq 1 ]; then
+    trap 'rm -f "$RUNS"' EXIT
+    DB_ARGS="--env=mem --load_num=$NUM"
+else
+    # Load the DB once.  Only ever remove what is in our own directory.
+    mkdir -p "$DB_PATH" &&
+        WORK=$(mktemp -d "$DB_PATH/bench.XXXXXX") ||
+        { echo "cannot create a directory in $DB_PATH" >&2; rm -f "$RUNS"; exit 1; }
+    trap 'rm -rf "$WORK" "$RUNS"' EXIT
+    SNAPSHOT=$WORK/base
+    DB=$WORK/db
+    echo "loading $NUM keys into $SNAPSHOT" >&2
+    "$DB_BENCH" --db="$SNAPSHOT" --benchmarks=fillseq --num="$NUM" \
+        --threads=1 > /dev/null 2>&1 ||
+        { echo "failed to load the DB" >&2; exit 1; }
+    DB_ARGS="--db=$DB --use_existing_db=1"
+fi
+
+# Print "micros_per_op ops_per_sec" for benchmark $1 run with $2 threads
+# from the db_bench output on stdin.  micros/op is the average over the
+# threads, so the aggregate throughput is threads / micros_per_op.
+# Progress messages end in \r rather than \n.
+parse() {
+    tr '\r' '\n' | awk -v name="$1" -v threads="$2" '
+        $1 == name && $2 == ":" && $4 == "micros/op;" {
+            printf "%s %.1f\n", $3, ($3 > 0 ? threads * 1e6 / $3 : 0)
+            found = 1
+        }
+        END { exit !found }'
+}
+
+for lock in $LOCKS; do
+    name=$(basename "$lock" .sh)
+    if [ "$lock" = "stock" ]; then
+        run=""
+    else
+        case $lock in
+        */*) run=$lock ;;
+        *) run=$LITL/$lock ;;
+        esac
+        if [ ! -x "$run" ]; then
+            echo "skipping $lock: not found" >&2
+            continue
+        fi
+    fi
+    for w in $WORKLOADS; do
+        for t in $THREADS; do
+            for rep in $(seq 1 "$REPS"); do
+                if [ $MEMENV -eq 0 ]; then
+                    rm -rf "$DB"
+                    cp -a "$SNAPSHOT" "$DB"
+                fi
+                log=/dev/null
+                [ -n "$LOG_DIR" ] && log=$LOG_DIR/$name.$w.$t.$rep
+                echo "$name $w threads=$t rep=$rep" >&2
+                res=$(timeout "$TIMEOUT" $run "$DB_BENCH" $DB_ARGS \
+                      --num="$NUM" --benchmarks="$w" \
+                      --threads="$t" --time_ms="$DURATION" "$@" 2>&1 |
+                      tee "$log" | parse "$w" "$t") ||
+                    { echo "$name $w with $t threads failed" >&2; continue; }
+                echo "$name,$w,$t,$rep,${res/ /,}" >> "$RUNS"
+            done
+        done
+    done
 done
+
+if [ -n "$RAW" ]; then
+    echo "lock,workload,threads,rep,micros_per_op,ops_per_sec" > "$RAW"
+    cat "$RUNS" >> "$RAW"
+fi
+
+echo "lock,workload,threads,runs,mean_ops_per_sec,stddev_ops_per_sec,mean_micros_per_op,stddev_micros_per_op"
+awk -F, '
+    {
+        key = $1 "," $2 "," $3
+        if (!(key in n)) order[++keys] = key
+        n[key]++
+        s[key] += $6; ss[key] += $6 * $6
+        m[key] += $5; mm[key] += $5 * $5
+    }
+    function sd(sum, sq, k) {
+        return k > 1 && sq - sum * sum / k > 0 ? sqrt((sq - sum * sum / k) / (k - 1)) : 0
+    }
+    END {
+        for (i = 1; i <= keys; i++) {
+            k = order[i]
+            printf "%s,%d,%.1f,%.1f,%.3f,%.3f\n", k, n[k],
+                   s[k] / n[k], sd(s[k], ss[k], n[k]),
+                   m[k] / n[k], sd(m[k], mm[k], n[k])
+        }
+    }' "$RUNS"
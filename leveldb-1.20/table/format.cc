@@ -4,6 +4,7 @@
 
 #include "table/format.h"
 
+#include <vector>
 #include "leveldb/env.h"
 #include "port/port.h"
 #include "table/block.h"
@@ -62,24 +63,15 @@ Status Footer::DecodeFrom(Slice* input) {
   return result;
 }
 
-Status ReadBlock(RandomAccessFile* file,
-                 const ReadOptions& options,
-                 const BlockHandle& handle,
-                 BlockContents* result) {
-  result->data = Slice();
-  result->cachable = false;
-  result->heap_allocated = false;
-
-  // Read the block contents as well as the type/crc footer.
-  // See table_builder.cc for the code that built this structure.
-  size_t n = static_cast<size_t>(handle.size());
-  char* buf = new char[n + kBlockTrailerSize];
-  Slice contents;
-  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
-  if (!s.ok()) {
-    delete[] buf;
-    return s;
-  }
+// Check and uncompress the block contents read into "contents" (which
+// may point into "buf", a buffer of n + kBlockTrailerSize bytes owned by
+// the caller until this call).  On success fills *result; "buf" is
+// either handed over to *result or deleted.
+static Status DecodeBlock(const ReadOptions& options,
+                          size_t n,
+                          char* buf,
+                          const Slice& contents,
+                          BlockContents* result) {
   if (contents.size() != n + kBlockTrailerSize) {
     delete[] buf;
     return Status::Corruption("truncated block read");
@@ -92,8 +84,7 @@ Status ReadBlock(RandomAccessFile* file,
     const uint32_t actual = crc32c::Value(data, n + 1);
     if (actual != crc) {
       delete[] buf;
-      s = Status::Corruption("block checksum mismatch");
-      return s;
+      return Status::Corruption("block checksum mismatch");
     }
   }
 
@@ -141,4 +132,60 @@ Status ReadBlock(RandomAccessFile* file,
   return Status::OK();
 }
 
+Status ReadBlock(RandomAccessFile* file,
+                 const ReadOptions& options,
+                 const BlockHandle& handle,
+                 BlockContents* result) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+
+  // Read the block contents as well as the type/crc footer.
+  // See table_builder.cc for the code that built this structure.
+  size_t n = static_cast<size_t>(handle.size());
+  char* buf = new char[n + kBlockTrailerSize];
+  Slice contents;
+  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
+  if (!s.ok()) {
+    delete[] buf;
+    return s;
+  }
+  return DecodeBlock(options, n, buf, contents, result);
+}
+
+Status ReadBlocks(RandomAccessFile* file,
+                  const ReadOptions& options,
+                  size_t num,
+                  const BlockHandle* handles,
+                  BlockContents* results,
+                  Status* statuses) {
+  std::vector<ReadRequest> reqs(num);
+  for (size_t i = 0; i < num; i++) {
+    results[i].data = Slice();
+    results[i].cachable = false;
+    results[i].heap_allocated = false;
+    reqs[i].offset = handles[i].offset();
+    reqs[i].n = static_cast<size_t>(handles[i].size()) + kBlockTrailerSize;
+    reqs[i].scratch = new char[reqs[i].n];
+  }
+  if (num > 0) {
+    file->MultiRead(&reqs[0], num);
+  }
+
+  Status result;
+  for (size_t i = 0; i < num; i++) {
+    if (reqs[i].status.ok()) {
+      statuses[i] = DecodeBlock(options, reqs[i].n - kBlockTrailerSize,
+                                reqs[i].scratch, reqs[i].result, &results[i]);
+    } else {
+      delete[] reqs[i].scratch;
+      statuses[i] = reqs[i].status;
+    }
+    if (result.ok() && !statuses[i].ok()) {
+      result = statuses[i];
+    }
+  }
+  return result;
+}
+
 }  // namespace leveldb
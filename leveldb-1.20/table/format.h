@@ -96,6 +96,17 @@ extern Status ReadBlock(RandomAccessFile* file,
                         const BlockHandle& handle,
                         BlockContents* result);
 
+// Read the blocks identified by handles[0..num-1] from "file", letting
+// the file issue the reads concurrently (see RandomAccessFile::MultiRead).
+// Stores the outcome of each read in statuses[i] and, when that is OK,
+// the block in results[i].  Returns the first non-OK status, if any.
+extern Status ReadBlocks(RandomAccessFile* file,
+                         const ReadOptions& options,
+                         size_t num,
+                         const BlockHandle* handles,
+                         BlockContents* results,
+                         Status* statuses);
+
 // Implementation details follow.  Clients should ignore,
 
 inline BlockHandle::BlockHandle()
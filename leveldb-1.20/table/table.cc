@@ -4,6 +4,10 @@
 
 #include "leveldb/table.h"
 
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
 #include "leveldb/cache.h"
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
@@ -17,29 +21,97 @@
 
 namespace leveldb {
 
-struct Table::Rep {
-  ~Rep() {
+// The index and filter blocks of a table, as kept in a metadata cache.
+// They do not refer to the table's file, so they may outlive the Table.
+struct TableMeta {
+  ~TableMeta() {
     delete filter;
     delete [] filter_data;
     delete index_block;
   }
 
+  BlockHandle metaindex_handle;
+  Block* index_block;
+  FilterBlockReader* filter;
+  const char* filter_data;
+};
+
+static void DeleteTableMeta(const Slice& key, void* value) {
+  delete reinterpret_cast<TableMeta*>(value);
+}
+
+// Give "contents" a heap copy of its data, so that it does not point
+// into a file mapping that goes away with the table's file.
+static void CopyToHeap(BlockContents* contents) {
+  if (!contents->heap_allocated) {
+    char* buf = new char[contents->data.size()];
+    memcpy(buf, contents->data.data(), contents->data.size());
+    contents->data = Slice(buf, contents->data.size());
+    contents->heap_allocated = true;
+  }
+}
+
+struct Table::Rep {
+  ~Rep() {
+    if (meta_handle != NULL) {
+      // index_block and filter belong to the metadata cache entry
+      meta_cache->Release(meta_handle);
+    } else {
+      delete filter;
+      delete [] filter_data;
+      delete index_block;
+    }
+  }
+
   Options options;
   Status status;
   RandomAccessFile* file;
   uint64_t cache_id;
   FilterBlockReader* filter;
   const char* filter_data;
+  size_t filter_size;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
+
+  Cache* meta_cache;             // NULL if the metadata is not shared
+  Cache::Handle* meta_handle;    // Entry owning index_block and filter
 };
 
 Status Table::Open(const Options& options,
                    RandomAccessFile* file,
                    uint64_t size,
                    Table** table) {
+  return Open(options, file, size, NULL, Slice(), table);
+}
+
+Status Table::Open(const Options& options,
+                   RandomAccessFile* file,
+                   uint64_t size,
+                   Cache* meta_cache,
+                   const Slice& meta_key,
+                   Table** table) {
   *table = NULL;
+  Cache::Handle* meta_handle =
+      (meta_cache != NULL) ? meta_cache->Lookup(meta_key) : NULL;
+  if (meta_handle != NULL) {
+    // No need to read anything
+    TableMeta* meta = reinterpret_cast<TableMeta*>(meta_cache->Value(meta_handle));
+    Rep* rep = new Table::Rep;
+    rep->options = options;
+    rep->file = file;
+    rep->metaindex_handle = meta->metaindex_handle;
+    rep->index_block = meta->index_block;
+    rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
+    rep->filter_data = NULL;
+    rep->filter_size = 0;
+    rep->filter = meta->filter;
+    rep->meta_cache = meta_cache;
+    rep->meta_handle = meta_handle;
+    *table = new Table(rep);
+    return Status::OK();
+  }
+
   if (size < Footer::kEncodedLength) {
     return Status::Corruption("file is too short to be an sstable");
   }
@@ -54,18 +126,28 @@ Status Table::Open(const Options& options,
   s = footer.DecodeFrom(&footer_input);
   if (!s.ok()) return s;
 
-  // Read the index block
-  BlockContents contents;
+  // Read the index block, together with the metaindex block if we will
+  // need it: the two reads are issued as one batch.
+  ReadOptions opt;
+  if (options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  const bool need_meta = (options.filter_policy != NULL);
+  BlockHandle handles[2] = { footer.index_handle(), footer.metaindex_handle() };
+  BlockContents contents[2];
+  Status statuses[2];
   Block* index_block = NULL;
+  if (need_meta) {
+    ReadBlocks(file, opt, 2, handles, contents, statuses);
+    s = statuses[0];
+  } else {
+    s = ReadBlock(file, opt, handles[0], &contents[0]);
+  }
   if (s.ok()) {
-    ReadOptions opt;
-    if (options.paranoid_checks) {
-      opt.verify_checksums = true;
-    }
-    s = ReadBlock(file, opt, footer.index_handle(), &contents);
-    if (s.ok()) {
-      index_block = new Block(contents);
+    if (meta_cache != NULL) {
+      CopyToHeap(&contents[0]);
     }
+    index_block = new Block(contents[0]);
   }
 
   if (s.ok()) {
@@ -78,33 +160,43 @@ Status Table::Open(const Options& options,
     rep->index_block = index_block;
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->filter_data = NULL;
+    rep->filter_size = 0;
     rep->filter = NULL;
+    rep->meta_cache = meta_cache;
+    rep->meta_handle = NULL;
     *table = new Table(rep);
-    (*table)->ReadMeta(footer);
+    // Do not propagate metaindex errors since meta info is not needed
+    // for operation
+    if (need_meta && statuses[1].ok()) {
+      (*table)->ReadMeta(contents[1]);
+    }
+
+    if (meta_cache != NULL) {
+      // Hand the blocks over to the metadata cache
+      TableMeta* meta = new TableMeta;
+      meta->metaindex_handle = rep->metaindex_handle;
+      meta->index_block = rep->index_block;
+      meta->filter = rep->filter;
+      meta->filter_data = rep->filter_data;
+      rep->filter_data = NULL;
+      rep->meta_handle = meta_cache->Insert(
+          meta_key, meta, index_block->size() + rep->filter_size,
+          &DeleteTableMeta);
+    }
   } else {
     delete index_block;
+    if (need_meta && statuses[1].ok() && contents[1].heap_allocated) {
+      delete[] contents[1].data.data();
+    }
   }
 
   return s;
 }
 
-void Table::ReadMeta(const Footer& footer) {
-  if (rep_->options.filter_policy == NULL) {
-    return;  // Do not need any metadata
-  }
-
+void Table::ReadMeta(const BlockContents& metaindex_contents) {
   // TODO(sanjay): Skip this if footer.metaindex_handle() size indicates
   // it is an empty block.
-  ReadOptions opt;
-  if (rep_->options.paranoid_checks) {
-    opt.verify_checksums = true;
-  }
-  BlockContents contents;
-  if (!ReadBlock(rep_->file, opt, footer.metaindex_handle(), &contents).ok()) {
-    // Do not propagate errors since meta info is not needed for operation
-    return;
-  }
-  Block* meta = new Block(contents);
+  Block* meta = new Block(metaindex_contents);
 
   Iterator* iter = meta->NewIterator(BytewiseComparator());
   std::string key = "filter.";
@@ -134,6 +226,10 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
   if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
     return;
   }
+  if (rep_->meta_cache != NULL) {
+    CopyToHeap(&block);
+  }
+  rep_->filter_size = block.data.size();
   if (block.heap_allocated) {
     rep_->filter_data = block.data.data();     // Will need to delete later
   }
@@ -217,10 +313,204 @@ Iterator* Table::BlockReader(void* arg,
   return iter;
 }
 
+// Readahead kicks in once this many data blocks in a row have been read
+// in file order, first fetching kMinReadahead blocks at once and then
+// doubling the amount on every refill up to kMaxReadahead blocks.  Only
+// iterators created with fill_cache == false read ahead.
+static const int kReadaheadTrigger = 2;
+static const int kMinReadahead = 4;
+static const int kMaxReadahead = 64;
+
+struct Table::ScanState {
+  struct Pending {
+    BlockHandle handle;
+    Block* block;  // NULL if the block is to be read through BlockReader
+  };
+
+  Table* table;
+  Iterator* index_iter;  // Positioned at the last handle fetched, or NULL
+  uint64_t next_offset;  // Offset of the block following the last one read
+  int sequential;        // Number of in-order block reads in a row
+  int window;            // Size of the last readahead, in blocks
+  std::deque<Pending> pending;  // Blocks read ahead, in file order
+
+  explicit ScanState(Table* t)
+      : table(t), index_iter(NULL), next_offset(0), sequential(0), window(0) {
+  }
+
+  ~ScanState() {
+    DropPending();
+    delete index_iter;
+  }
+
+  void DropPending() {
+    for (size_t i = 0; i < pending.size(); i++) {
+      delete pending[i].block;
+    }
+    pending.clear();
+  }
+
+  // Position index_iter at the entry for "handle".  Returns false if
+  // there is no such entry.
+  bool SeekIndex(const BlockHandle& handle) {
+    if (index_iter == NULL) {
+      index_iter = table->rep_->index_block->NewIterator(
+          table->rep_->options.comparator);
+      index_iter->SeekToFirst();
+    } else if (index_iter->Valid()) {
+      // Usually the block right after the last one fetched
+      index_iter->Next();
+    }
+    if (IndexAt(handle)) {
+      return true;
+    }
+    // Index values are not searchable, but index blocks are small and
+    // this only happens once per sequential run.
+    for (index_iter->SeekToFirst(); index_iter->Valid(); index_iter->Next()) {
+      if (IndexAt(handle)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool IndexAt(const BlockHandle& handle) const {
+    if (!index_iter->Valid()) {
+      return false;
+    }
+    Slice input = index_iter->value();
+    BlockHandle h;
+    return h.DecodeFrom(&input).ok() && h.offset() == handle.offset();
+  }
+
+  bool InBlockCache(const BlockHandle& handle) const {
+    Cache* block_cache = table->rep_->options.block_cache;
+    if (block_cache == NULL) {
+      return false;
+    }
+    char cache_key_buffer[16];
+    EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
+    EncodeFixed64(cache_key_buffer+8, handle.offset());
+    // Only a probe: the block is not used yet, so do not promote it
+    return block_cache->Contains(
+        Slice(cache_key_buffer, sizeof(cache_key_buffer)));
+  }
+
+  // Fetch "handle" and the blocks after it with a single batched read,
+  // leaving all but the first in "pending".  Returns the block for
+  // "handle", or NULL if it should be read through BlockReader.
+  Block* Readahead(const ReadOptions& options, const BlockHandle& handle) {
+    if (!SeekIndex(handle)) {
+      return NULL;
+    }
+    window = (window == 0) ? kMinReadahead : std::min(2 * window, kMaxReadahead);
+
+    std::vector<Pending> blocks;
+    Pending p;
+    p.handle = handle;
+    p.block = NULL;
+    blocks.push_back(p);
+    while (static_cast<int>(blocks.size()) < window) {
+      index_iter->Next();
+      if (!index_iter->Valid()) {
+        break;
+      }
+      Slice input = index_iter->value();
+      if (!p.handle.DecodeFrom(&input).ok()) {
+        break;
+      }
+      blocks.push_back(p);
+    }
+
+    // Blocks already in the cache are served from there; the others are
+    // read here and deliberately kept out of the cache, so that a scan
+    // does not evict the working set of point lookups.
+    std::vector<BlockHandle> handles;
+    std::vector<size_t> slots;
+    for (size_t i = 0; i < blocks.size(); i++) {
+      if (!InBlockCache(blocks[i].handle)) {
+        handles.push_back(blocks[i].handle);
+        slots.push_back(i);
+      }
+    }
+    if (!handles.empty()) {
+      std::vector<BlockContents> contents(handles.size());
+      std::vector<Status> statuses(handles.size());
+      ReadBlocks(table->rep_->file, options, handles.size(), &handles[0],
+                 &contents[0], &statuses[0]);
+      for (size_t i = 0; i < handles.size(); i++) {
+        // Failed reads are retried, and reported, by BlockReader
+        if (statuses[i].ok()) {
+          blocks[slots[i]].block = new Block(contents[i]);
+        }
+      }
+    }
+
+    pending.insert(pending.end(), blocks.begin() + 1, blocks.end());
+    return blocks[0].block;
+  }
+};
+
+void Table::DeleteScanState(void* arg, void* ignored) {
+  delete reinterpret_cast<ScanState*>(arg);
+}
+
+// Like BlockReader, but reads ahead of scans that visit the data blocks
+// in file order.
+Iterator* Table::ScanBlockReader(void* arg,
+                                 const ReadOptions& options,
+                                 const Slice& index_value) {
+  ScanState* state = reinterpret_cast<ScanState*>(arg);
+  BlockHandle handle;
+  Slice input = index_value;
+  if (!handle.DecodeFrom(&input).ok()) {
+    return BlockReader(state->table, options, index_value);
+  }
+  const uint64_t offset = handle.offset();
+  const uint64_t next_offset = offset + handle.size() + kBlockTrailerSize;
+
+  Block* block = NULL;
+  if (!state->pending.empty() &&
+      state->pending.front().handle.offset() == offset) {
+    block = state->pending.front().block;
+    state->pending.pop_front();
+  } else {
+    // Not a block we read ahead: the scan changed direction or position
+    state->DropPending();
+    if (offset == state->next_offset) {
+      state->sequential++;
+    } else {
+      state->sequential = 0;
+      state->window = 0;
+    }
+    if (state->sequential >= kReadaheadTrigger) {
+      block = state->Readahead(options, handle);
+    }
+  }
+  state->next_offset = next_offset;
+
+  if (block == NULL) {
+    return BlockReader(state->table, options, index_value);
+  }
+  Iterator* iter = block->NewIterator(state->table->rep_->options.comparator);
+  iter->RegisterCleanup(&DeleteBlock, block, NULL);
+  return iter;
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
+  if (options.fill_cache) {
+    // Reading ahead would make the next Next() wait for several blocks,
+    // which only pays off for bulk scans such as compactions.
+    return NewTwoLevelIterator(
+        rep_->index_block->NewIterator(rep_->options.comparator),
+        &Table::BlockReader, const_cast<Table*>(this), options);
+  }
+  ScanState* state = new ScanState(const_cast<Table*>(this));
+  Iterator* iter = NewTwoLevelIterator(
       rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+      &Table::ScanBlockReader, state, options);
+  iter->RegisterCleanup(&DeleteScanState, state, NULL);
+  return iter;
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
@@ -110,7 +110,7 @@ class StringSink: public WritableFile {
 class StringSource: public RandomAccessFile {
  public:
   StringSource(const Slice& contents)
-      : contents_(contents.data(), contents.size()) {
+      : contents_(contents.data(), contents.size()), multi_reads_(0) {
   }
 
   virtual ~StringSource() { }
@@ -130,8 +130,17 @@ class StringSource: public RandomAccessFile {
     return Status::OK();
   }
 
+  virtual Status MultiRead(ReadRequest* reqs, size_t num) const {
+    multi_reads_ += num;
+    return RandomAccessFile::MultiRead(reqs, num);
+  }
+
+  // Number of reads issued through MultiRead()
+  size_t multi_reads() const { return multi_reads_; }
+
  private:
   std::string contents_;
+  mutable size_t multi_reads_;
 };
 
 typedef std::map<std::string, std::string, STLLessThan> KVMap;
@@ -254,10 +263,16 @@ class TableConstructor: public Constructor {
     return table_->NewIterator(ReadOptions());
   }
 
+  Iterator* NewIterator(const ReadOptions& options) const {
+    return table_->NewIterator(options);
+  }
+
   uint64_t ApproximateOffsetOf(const Slice& key) const {
     return table_->ApproximateOffsetOf(key);
   }
 
+  size_t multi_reads() const { return source_->multi_reads(); }
+
  private:
   void Reset() {
     delete table_;
@@ -827,6 +842,65 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
 
 }
 
+TEST(TableTest, ReadaheadScan) {
+  TableConstructor c(BytewiseComparator());
+  char buf[16];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(buf, sizeof(buf), "k%06d", i);
+    c.Add(buf, std::string(100, 'a' + (i % 26)));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 256;
+  options.compression = kNoCompression;
+  c.Finish(options, &keys, &kvmap);
+  const size_t opened = c.multi_reads();
+
+  // Iterators that fill the cache do not read ahead
+  Iterator* iter = c.NewIterator();
+  int n = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    n++;
+  }
+  ASSERT_EQ(1000, n);
+  ASSERT_EQ(opened, c.multi_reads());
+  delete iter;
+
+  // A bulk forward scan reads ahead and still sees every entry
+  ReadOptions bulk;
+  bulk.fill_cache = false;
+  iter = c.NewIterator(bulk);
+  KVMap::const_iterator model = kvmap.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++model) {
+    ASSERT_TRUE(model != kvmap.end());
+    ASSERT_EQ(model->first, iter->key().ToString());
+    ASSERT_EQ(model->second, iter->value().ToString());
+  }
+  ASSERT_TRUE(model == kvmap.end());
+  ASSERT_OK(iter->status());
+  ASSERT_GT(c.multi_reads(), opened + 300);  // ~330 data blocks
+
+  // Changing direction or position drops the blocks read ahead
+  iter->Seek("k000500");
+  ASSERT_EQ("k000500", iter->key().ToString());
+  iter->Next();
+  iter->Next();
+  iter->Prev();
+  iter->Prev();
+  iter->Prev();
+  ASSERT_EQ("k000499", iter->key().ToString());
+  iter->Seek("k000990");
+  for (int i = 990; i < 1000; i++) {
+    ASSERT_TRUE(iter->Valid());
+    snprintf(buf, sizeof(buf), "k%06d", i);
+    ASSERT_EQ(buf, iter->key().ToString());
+    iter->Next();
+  }
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+}
+
 static bool SnappyCompressionSupported() {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
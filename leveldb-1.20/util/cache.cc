@@ -163,6 +163,7 @@ class LRUCache {
                         void* value, size_t charge,
                         void (*deleter)(const Slice& key, void* value));
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  bool Contains(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
   void Erase(const Slice& key, uint32_t hash);
   void Prune();
@@ -178,6 +179,11 @@ class LRUCache {
   void Unref(LRUHandle* e);
   bool FinishErase(LRUHandle* e);
 
+  struct LookupArgs;
+  struct ReleaseArgs;
+  static void* LookupLocked(void* arg);
+  static void* ReleaseLocked(void* arg);
+
   // Initialized before use.
   size_t capacity_;
 
@@ -252,18 +258,48 @@ void LRUCache::LRU_Append(LRUHandle* list, LRUHandle* e) {
   e->next->prev = e;
 }
 
-Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
-  MutexLock l(&mutex_);
-  LRUHandle* e = table_.Lookup(key, hash);
+// Lookup() and Release() are short and run on every block read, so they
+// hand their critical section to the mutex (see port::Mutex::Run).
+struct LRUCache::LookupArgs {
+  LRUCache* cache;
+  const Slice* key;
+  uint32_t hash;
+};
+
+void* LRUCache::LookupLocked(void* arg) {
+  LookupArgs* args = reinterpret_cast<LookupArgs*>(arg);
+  LRUHandle* e = args->cache->table_.Lookup(*args->key, args->hash);
   if (e != NULL) {
-    Ref(e);
+    args->cache->Ref(e);
   }
-  return reinterpret_cast<Cache::Handle*>(e);
+  return e;
 }
 
-void LRUCache::Release(Cache::Handle* handle) {
+Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
+  LookupArgs args = { this, &key, hash };
+  return reinterpret_cast<Cache::Handle*>(mutex_.Run(&LookupLocked, &args));
+}
+
+// Leaves the entry where it is in the LRU list
+bool LRUCache::Contains(const Slice& key, uint32_t hash) {
   MutexLock l(&mutex_);
-  Unref(reinterpret_cast<LRUHandle*>(handle));
+  return table_.Lookup(key, hash) != NULL;
+}
+
+struct LRUCache::ReleaseArgs {
+  LRUCache* cache;
+  LRUHandle* handle;
+};
+
+void* LRUCache::ReleaseLocked(void* arg) {
+  ReleaseArgs* args = reinterpret_cast<ReleaseArgs*>(arg);
+  args->cache->Unref(args->handle);
+  return NULL;
+}
+
+void LRUCache::Release(Cache::Handle* handle) {
+  ReleaseArgs args = { this, reinterpret_cast<LRUHandle*>(handle) };
+  mutex_.Run(&ReleaseLocked, &args);
 }
 
 Cache::Handle* LRUCache::Insert(
@@ -367,6 +403,10 @@ class ShardedLRUCache : public Cache {
     const uint32_t hash = HashSlice(key);
     return shard_[Shard(hash)].Lookup(key, hash);
   }
+  virtual bool Contains(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Contains(key, hash);
+  }
   virtual void Release(Handle* handle) {
     LRUHandle* h = reinterpret_cast<LRUHandle*>(handle);
     shard_[Shard(h->hash)].Release(handle);
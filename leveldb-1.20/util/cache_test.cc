@@ -156,6 +156,23 @@ TEST(CacheTest, EvictionPolicy) {
   cache_->Release(h);
 }
 
+TEST(CacheTest, ContainsDoesNotPromote) {
+  Insert(100, 101);
+  Insert(200, 201);
+  ASSERT_TRUE(cache_->Contains(EncodeKey(100)));
+  ASSERT_TRUE(!cache_->Contains(EncodeKey(300)));
+
+  // Entry 100 is only probed, so it ages out like entry 200.
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_TRUE(cache_->Contains(EncodeKey(1000+i)));
+    cache_->Contains(EncodeKey(100));
+  }
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_TRUE(!cache_->Contains(EncodeKey(100)));
+}
+
 TEST(CacheTest, UseExceedsCacheSize) {
   // Overfill the cache, keeping handles on all inserted entries.
   std::vector<Cache::Handle*> h;
@@ -13,12 +13,30 @@ Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
 
+Status Env::NewLogFile(const std::string& fname, bool append,
+                       WritableFile** result) {
+  return append ? NewAppendableFile(fname, result)
+                : NewWritableFile(fname, result);
+}
+
 SequentialFile::~SequentialFile() {
 }
 
 RandomAccessFile::~RandomAccessFile() {
 }
 
+Status RandomAccessFile::MultiRead(ReadRequest* reqs, size_t num) const {
+  Status result;
+  for (size_t i = 0; i < num; i++) {
+    reqs[i].status = Read(reqs[i].offset, reqs[i].n, &reqs[i].result,
+                          reqs[i].scratch);
+    if (result.ok() && !reqs[i].status.ok()) {
+      result = reqs[i].status;
+    }
+  }
+  return result;
+}
+
 WritableFile::~WritableFile() {
 }
 
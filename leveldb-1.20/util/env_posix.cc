@@ -16,6 +16,11 @@
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
+#if defined(LEVELDB_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
 #include <deque>
 #include <limits>
 #include <set>
@@ -122,6 +127,267 @@ class PosixSequentialFile: public SequentialFile {
   }
 };
 
+static Status PosixRead(const std::string& fname, int fd, uint64_t offset,
+                        size_t n, Slice* result, char* scratch) {
+  ssize_t r = pread(fd, scratch, n, static_cast<off_t>(offset));
+  *result = Slice(scratch, (r < 0) ? 0 : r);
+  if (r < 0) {
+    // An error: return a non-ok status
+    return IOError(fname, errno);
+  }
+  return Status::OK();
+}
+
+#if defined(LEVELDB_IO_URING)
+// A minimal io_uring(7) instance used by PosixRandomAccessFile::MultiRead()
+// to have the kernel work on a batch of reads concurrently.  It talks to
+// the kernel through the raw system calls so that no liburing is needed.
+// Not thread-safe: every thread uses its own ring (see ThreadRing()).
+class IOUring {
+ public:
+  enum { kEntries = 64 };  // Max number of reads submitted per batch
+
+  IOUring()
+      : ring_fd_(-1), sq_ring_(NULL), cq_ring_(NULL), sqes_(NULL),
+        sq_ring_len_(0), cq_ring_len_(0), sqes_len_(0) {
+  }
+
+  ~IOUring() {
+    if (sqes_ != NULL) munmap(sqes_, sqes_len_);
+    if (cq_ring_ != NULL && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_len_);
+    if (sq_ring_ != NULL) munmap(sq_ring_, sq_ring_len_);
+    if (ring_fd_ >= 0) close(ring_fd_);
+  }
+
+  // Set up the ring.  Returns 0 on success, else an errno value.
+  int Init() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, kEntries, &p);
+    if (fd < 0) {
+      return errno;
+    }
+    ring_fd_ = fd;
+
+    sq_ring_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_len_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      // Both rings live in one mapping
+      if (cq_ring_len_ > sq_ring_len_) sq_ring_len_ = cq_ring_len_;
+      cq_ring_len_ = sq_ring_len_;
+    }
+    void* sq = mmap(NULL, sq_ring_len_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+      return errno;
+    }
+    sq_ring_ = sq;
+    if (single_mmap) {
+      cq_ring_ = sq_ring_;
+    } else {
+      void* cq = mmap(NULL, cq_ring_len_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq == MAP_FAILED) {
+        return errno;
+      }
+      cq_ring_ = cq;
+    }
+    sqes_len_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, sqes_len_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      return errno;
+    }
+    sqes_ = reinterpret_cast<struct io_uring_sqe*>(sqes);
+
+    char* sqp = reinterpret_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sqp + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sqp + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sqp + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sqp + p.sq_off.array);
+    char* cqp = reinterpret_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cqp + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cqp + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cqp + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cqp + p.cq_off.cqes);
+    return 0;
+  }
+
+  // Issue reqs[0,num-1] (num <= kEntries) against "fd" and wait for them.
+  // Returns the number k of leading requests that went through the ring;
+  // res[i] for i < k then holds the byte count or negative errno of
+  // request i.  Requests [k,num-1] were not issued at all.  If waiting
+  // for the reads failed, sets "*err" to the errno: the reads still in
+  // flight were cancelled and drained, and the ring must not be used
+  // again.  Else sets "*err" to 0.
+  size_t Read(int fd, const ReadRequest* reqs, size_t num, int* res,
+              int* err) {
+    *err = 0;
+    const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail_;
+    for (size_t i = 0; i < num; i++) {
+      const unsigned index = tail & sq_mask_;
+      struct io_uring_sqe* sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      iovecs_[i].iov_base = reqs[i].scratch;
+      iovecs_[i].iov_len = reqs[i].n;
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = fd;
+      sqe->off = reqs[i].offset;
+      sqe->addr = reinterpret_cast<uintptr_t>(&iovecs_[i]);
+      sqe->len = 1;
+      sqe->user_data = i;
+      sq_array_[index] = index;
+      tail++;
+    }
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+    int submitted;
+    do {
+      submitted = syscall(__NR_io_uring_enter, ring_fd_, num, 0, 0, NULL, 0);
+    } while (submitted < 0 &&
+             (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+    if (submitted < 0) {
+      submitted = 0;
+    }
+    if (static_cast<size_t>(submitted) < num) {
+      // Drop whatever the kernel did not consume; the caller falls back
+      // to pread() for those.
+      __atomic_store_n(sq_tail_, head + submitted, __ATOMIC_RELEASE);
+    }
+
+    bool done[kEntries] = { false };
+    size_t pending = submitted;
+    while (pending > 0) {
+      unsigned cq_head = *cq_head_;
+      const unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      if (cq_head == cq_tail) {
+        int r = syscall(__NR_io_uring_enter, ring_fd_, 0, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+          if (*err == 0) {
+            *err = errno;
+            Cancel(done, submitted);
+          } else {
+            // The kernel still owns the buffers of the in-flight reads:
+            // poll the completion queue until it gives them back.
+            usleep(100);
+          }
+        }
+        continue;
+      }
+      while (cq_head != cq_tail) {
+        const struct io_uring_cqe* cqe = &cqes_[cq_head & cq_mask_];
+        if (cqe->user_data < kEntries) {
+          res[cqe->user_data] = cqe->res;
+          done[cqe->user_data] = true;
+          pending--;
+        }  // Else the completion of a cancellation
+        cq_head++;
+      }
+      __atomic_store_n(cq_head_, cq_head, __ATOMIC_RELEASE);
+    }
+    return submitted;
+  }
+
+ private:
+  int ring_fd_;
+  void* sq_ring_;
+  void* cq_ring_;
+  struct io_uring_sqe* sqes_;
+  size_t sq_ring_len_;
+  size_t cq_ring_len_;
+  size_t sqes_len_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe* cqes_;
+  struct iovec iovecs_[kEntries];
+
+  // Best effort: ask the kernel to cancel the reads [0,num-1] that are
+  // not done yet, so that draining them does not wait for the device.
+  void Cancel(const bool* done, size_t num) {
+    unsigned tail = *sq_tail_;
+    unsigned count = 0;
+    for (size_t i = 0; i < num; i++) {
+      if (done[i]) {
+        continue;
+      }
+      const unsigned index = tail & sq_mask_;
+      struct io_uring_sqe* sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = i;  // The user_data of the read to cancel
+      sqe->user_data = kEntries + i;
+      sq_array_[index] = index;
+      tail++;
+      count++;
+    }
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    syscall(__NR_io_uring_enter, ring_fd_, count, 0, 0, NULL, 0);
+  }
+
+  // No copying allowed
+  IOUring(const IOUring&);
+  void operator=(const IOUring&);
+};
+
+static pthread_once_t io_uring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t io_uring_key;
+// Non-NULL once io_uring turned out not to be usable in this process.
+static port::AtomicPointer io_uring_unavailable;
+
+static void DeleteRing(void* ring) {
+  delete reinterpret_cast<IOUring*>(ring);
+}
+
+static void InitRingKey() {
+  if (pthread_key_create(&io_uring_key, &DeleteRing) != 0) {
+    io_uring_unavailable.Release_Store(&io_uring_key);
+  }
+}
+
+// Return the io_uring instance of the calling thread, creating it on
+// first use, or NULL if io_uring cannot be used.
+static IOUring* ThreadRing() {
+  if (io_uring_unavailable.Acquire_Load() != NULL) {
+    return NULL;
+  }
+  pthread_once(&io_uring_once, &InitRingKey);
+  if (io_uring_unavailable.Acquire_Load() != NULL) {
+    return NULL;
+  }
+  IOUring* ring = reinterpret_cast<IOUring*>(pthread_getspecific(io_uring_key));
+  if (ring == NULL) {
+    ring = new IOUring;
+    int err = ring->Init();
+    if (err != 0) {
+      delete ring;
+      // Not supported by this kernel, not permitted, or out of resources
+      // such as locked memory: stop trying rather than calling
+      // io_uring_setup() again on every read.
+      io_uring_unavailable.Release_Store(&io_uring_key);
+      return NULL;
+    }
+    pthread_setspecific(io_uring_key, ring);
+  }
+  return ring;
+}
+
+// Discard the io_uring instance of the calling thread after a failure;
+// the next ThreadRing() sets up a new one.
+static void DropThreadRing() {
+  delete reinterpret_cast<IOUring*>(pthread_getspecific(io_uring_key));
+  pthread_setspecific(io_uring_key, NULL);
+}
+#endif  // defined(LEVELDB_IO_URING)
+
 // pread() based random-access
 class PosixRandomAccessFile: public RandomAccessFile {
  private:
@@ -158,19 +424,77 @@ class PosixRandomAccessFile: public RandomAccessFile {
       }
     }
 
-    Status s;
-    ssize_t r = pread(fd, scratch, n, static_cast<off_t>(offset));
-    *result = Slice(scratch, (r < 0) ? 0 : r);
-    if (r < 0) {
-      // An error: return a non-ok status
-      s = IOError(filename_, errno);
-    }
+    Status s = PosixRead(filename_, fd, offset, n, result, scratch);
     if (temporary_fd_) {
       // Close the temporary file descriptor opened earlier.
       close(fd);
     }
     return s;
   }
+
+  virtual Status MultiRead(ReadRequest* reqs, size_t num) const {
+    int fd = fd_;
+    if (temporary_fd_) {
+      fd = open(filename_.c_str(), O_RDONLY);
+      if (fd < 0) {
+        Status s = IOError(filename_, errno);
+        for (size_t i = 0; i < num; i++) {
+          reqs[i].result = Slice();
+          reqs[i].status = s;
+        }
+        return s;
+      }
+    }
+
+    size_t done = 0;
+#if defined(LEVELDB_IO_URING)
+    IOUring* ring = (num > 1) ? ThreadRing() : NULL;
+    while (ring != NULL && done < num) {
+      int res[IOUring::kEntries];
+      size_t batch = std::min<size_t>(num - done, IOUring::kEntries);
+      int err;
+      size_t issued = ring->Read(fd, reqs + done, batch, res, &err);
+      if (err != 0) {
+        DropThreadRing();
+        ring = NULL;
+      }
+      for (size_t i = 0; i < issued; i++) {
+        ReadRequest* req = &reqs[done + i];
+        if (err != 0) {
+          req->result = Slice();
+          req->status = IOError(filename_, err);
+        } else if (res[i] >= 0) {
+          req->result = Slice(req->scratch, res[i]);
+          req->status = Status::OK();
+        } else {
+          // Let pread() retry and report the error
+          req->status = PosixRead(filename_, fd, req->offset, req->n,
+                                  &req->result, req->scratch);
+        }
+      }
+      done += issued;
+      if (issued < batch) {
+        break;
+      }
+    }
+#endif
+    for (; done < num; done++) {
+      ReadRequest* req = &reqs[done];
+      req->status = PosixRead(filename_, fd, req->offset, req->n,
+                              &req->result, req->scratch);
+    }
+
+    if (temporary_fd_) {
+      // Close the temporary file descriptor opened earlier.
+      close(fd);
+    }
+    for (size_t i = 0; i < num; i++) {
+      if (!reqs[i].status.ok()) {
+        return reqs[i].status;
+      }
+    }
+    return Status::OK();
+  }
 };
 
 // mmap() based random-access
@@ -288,6 +612,143 @@ class PosixWritableFile : public WritableFile {
   }
 };
 
+// Write-ahead log files (see PosixEnv::NewLogFile).  Appends go to an
+// aligned buffer that is handed to pwrite(2) directly, and the file is
+// preallocated in large extents so that appends neither allocate blocks
+// nor grow the file size one at a time.
+class PosixLogFile : public WritableFile {
+ private:
+  static const size_t kBufferSize = 64 << 10;
+  static const size_t kBufferAlignment = 4096;
+  static const off_t kPreallocateSize = 4 << 20;
+
+  std::string filename_;
+  int fd_;
+  char* buf_;             // Data appended but not yet written to fd_
+  size_t pos_;            // Number of bytes used in buf_
+  uint64_t written_;      // Bytes written to fd_
+  off_t allocated_;       // File space preallocated so far
+  bool preallocate_;      // False once fallocate() turned out not to work
+
+  Status WriteRaw(const char* data, size_t n) {
+    Preallocate(written_ + n);
+    while (n > 0) {
+      ssize_t r = pwrite(fd_, data, n, written_);
+      if (r < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return IOError(filename_, errno);
+      }
+      data += r;
+      n -= r;
+      written_ += r;
+    }
+    return Status::OK();
+  }
+
+  Status FlushBuffer() {
+    Status s = WriteRaw(buf_, pos_);
+    pos_ = 0;
+    return s;
+  }
+
+  // Extend the preallocated region, if needed, to cover "size" bytes.
+  void Preallocate(uint64_t size) {
+#if defined(OS_LINUX)
+    if (!preallocate_ || static_cast<off_t>(size) <= allocated_) {
+      return;
+    }
+    const off_t end =
+        (static_cast<off_t>(size) / kPreallocateSize + 1) * kPreallocateSize;
+    // Grow the file size along with the space, so that fdatasync() need
+    // not write the inode back on every append.  Close() trims the zeros
+    // we did not use; after a crash log::Reader skips them, and as "end"
+    // is a multiple of log::kBlockSize, so are the records appended after
+    // them by NewLogFile(fname, true, ...).
+    if (fallocate(fd_, 0, allocated_, end - allocated_) == 0) {
+      allocated_ = end;
+    } else {
+      // Not supported by this filesystem: do without
+      preallocate_ = false;
+    }
+#endif
+  }
+
+ public:
+  PosixLogFile(const std::string& fname, int fd, uint64_t initial_size)
+      : filename_(fname), fd_(fd), buf_(NULL), pos_(0),
+        written_(initial_size), allocated_(initial_size),
+        preallocate_(true) {
+    void* buf = NULL;
+    if (posix_memalign(&buf, kBufferAlignment, kBufferSize) != 0) {
+      fprintf(stderr, "posix_memalign: out of memory\n");
+      abort();
+    }
+    buf_ = reinterpret_cast<char*>(buf);
+  }
+
+  virtual ~PosixLogFile() {
+    if (fd_ >= 0) {
+      // Ignoring any potential errors
+      Close();
+    }
+    free(buf_);
+  }
+
+  virtual Status Append(const Slice& data) {
+    const char* p = data.data();
+    size_t n = data.size();
+    size_t copy = std::min(n, kBufferSize - pos_);
+    memcpy(buf_ + pos_, p, copy);
+    pos_ += copy;
+    p += copy;
+    n -= copy;
+    if (n == 0) {
+      return Status::OK();
+    }
+
+    Status s = FlushBuffer();
+    if (!s.ok()) {
+      return s;
+    }
+    if (n < kBufferSize) {
+      memcpy(buf_, p, n);
+      pos_ = n;
+      return Status::OK();
+    }
+    // Too large for the buffer: write it out directly
+    return WriteRaw(p, n);
+  }
+
+  virtual Status Close() {
+    Status s = FlushBuffer();
+    if (allocated_ > static_cast<off_t>(written_)) {
+      // Give back the preallocated space we did not use
+      if (ftruncate(fd_, written_) != 0 && s.ok()) {
+        s = IOError(filename_, errno);
+      }
+    }
+    if (close(fd_) != 0 && s.ok()) {
+      s = IOError(filename_, errno);
+    }
+    fd_ = -1;
+    return s;
+  }
+
+  virtual Status Flush() {
+    return FlushBuffer();
+  }
+
+  virtual Status Sync() {
+    Status s = FlushBuffer();
+    if (s.ok() && fdatasync(fd_) != 0) {
+      s = IOError(filename_, errno);
+    }
+    return s;
+  }
+};
+
 static int LockOrUnlock(int fd, bool lock) {
   errno = 0;
   struct flock f;
@@ -398,6 +859,26 @@ class PosixEnv : public Env {
     return s;
   }
 
+  virtual Status NewLogFile(const std::string& fname, bool append,
+                            WritableFile** result) {
+    *result = NULL;
+    // Not O_APPEND: the end of the file is preallocated, so PosixLogFile
+    // writes at its own offset.
+    int fd = open(fname.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC),
+                  0644);
+    if (fd < 0) {
+      return IOError(fname, errno);
+    }
+    struct stat sbuf;
+    if (fstat(fd, &sbuf) != 0) {
+      Status s = IOError(fname, errno);
+      close(fd);
+      return s;
+    }
+    *result = new PosixLogFile(fname, fd, sbuf.st_size);
+    return Status::OK();
+  }
+
   virtual bool FileExists(const std::string& fname) {
     return access(fname.c_str(), F_OK) == 0;
   }
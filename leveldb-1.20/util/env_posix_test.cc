@@ -56,6 +56,91 @@ TEST(EnvPosixTest, TestOpenOnRead) {
   ASSERT_OK(env_->DeleteFile(test_file));
 }
 
+TEST(EnvPosixTest, TestMultiRead) {
+  std::string test_dir;
+  ASSERT_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/multi_read.txt";
+
+  std::string data;
+  for (int i = 0; i < 1000; i++) {
+    data.push_back(static_cast<char>('a' + (i % 26)));
+  }
+  ASSERT_OK(WriteStringToFile(env_, data, test_file));
+
+  // Exercise mmap-ed, pread() and open-on-read files alike.
+  const int kNumFiles = kReadOnlyFileLimit + kMMapLimit + 5;
+  leveldb::RandomAccessFile* files[kNumFiles] = {0};
+  for (int i = 0; i < kNumFiles; i++) {
+    ASSERT_OK(env_->NewRandomAccessFile(test_file, &files[i]));
+  }
+
+  // More requests than fit in a single io_uring batch.
+  const int kNumReqs = 150;
+  const size_t kReadSize = 5;
+  for (int i = 0; i < kNumFiles; i++) {
+    ReadRequest reqs[kNumReqs];
+    char scratch[kNumReqs][kReadSize];
+    for (int j = 0; j < kNumReqs; j++) {
+      reqs[j].offset = (j * 37 + i) % (data.size() - kReadSize);
+      reqs[j].n = kReadSize;
+      reqs[j].scratch = scratch[j];
+    }
+    ASSERT_OK(files[i]->MultiRead(reqs, kNumReqs));
+    for (int j = 0; j < kNumReqs; j++) {
+      ASSERT_OK(reqs[j].status);
+      ASSERT_EQ(data.substr(reqs[j].offset, kReadSize),
+                reqs[j].result.ToString());
+    }
+  }
+  for (int i = 0; i < kNumFiles; i++) {
+    delete files[i];
+  }
+  ASSERT_OK(env_->DeleteFile(test_file));
+}
+
+TEST(EnvPosixTest, TestLogFile) {
+  std::string test_dir;
+  ASSERT_OK(env_->GetTestDirectory(&test_dir));
+  std::string test_file = test_dir + "/000123.log";
+
+  WritableFile* file;
+  ASSERT_OK(env_->NewLogFile(test_file, false, &file));
+
+  // Enough data to go through the buffer and several preallocations
+  std::string expected;
+  for (int i = 0; i < 100000; i++) {
+    std::string record(i % 300, static_cast<char>('a' + (i % 26)));
+    ASSERT_OK(file->Append(record));
+    if (i % 100 == 0) {
+      ASSERT_OK(file->Flush());
+    }
+    if (i % 10000 == 0) {
+      ASSERT_OK(file->Sync());
+    }
+    expected.append(record);
+  }
+  ASSERT_OK(file->Sync());
+  ASSERT_OK(file->Close());
+  delete file;
+
+  // Preallocated space must not show up in the file
+  uint64_t size;
+  ASSERT_OK(env_->GetFileSize(test_file, &size));
+  ASSERT_EQ(expected.size(), size);
+  std::string contents;
+  ASSERT_OK(ReadFileToString(env_, test_file, &contents));
+  ASSERT_TRUE(contents == expected);
+
+  // Reopening for append continues at the end
+  ASSERT_OK(env_->NewLogFile(test_file, true, &file));
+  ASSERT_OK(file->Append("tail"));
+  ASSERT_OK(file->Close());
+  delete file;
+  ASSERT_OK(ReadFileToString(env_, test_file, &contents));
+  ASSERT_TRUE(contents == expected + "tail");
+  ASSERT_OK(env_->DeleteFile(test_file));
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -0,0 +1,234 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/hdr_histogram.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+namespace leveldb {
+
+namespace {
+
+int FloorLog2(uint64_t v) {
+  return 63 - __builtin_clzll(v);
+}
+
+const double kReportedPercentiles[] = { 50, 90, 99, 99.9, 99.99, 99.999 };
+const int kNumReportedPercentiles =
+    sizeof(kReportedPercentiles) / sizeof(kReportedPercentiles[0]);
+
+}  // namespace
+
+HdrHistogram::HdrHistogram(int significant_digits, uint64_t highest_value) {
+  if (significant_digits < 1) significant_digits = 1;
+  if (significant_digits > 4) significant_digits = 4;
+  // Each power of two needs 2 * 10^digits sub-buckets for the values in
+  // it to stay within the requested relative error.
+  uint64_t sub_buckets = 2;
+  for (int i = 0; i < significant_digits; i++) {
+    sub_buckets *= 10;
+  }
+  sub_bucket_bits_ = FloorLog2(sub_buckets - 1) + 1;
+  if (highest_value < (1ull << sub_bucket_bits_)) {
+    highest_value = (1ull << sub_bucket_bits_);
+  }
+  highest_value_ = highest_value;
+  num_counts_ = IndexFor(highest_value) + 1;
+  Clear();
+}
+
+void HdrHistogram::Clear() {
+  counts_.clear();
+  count_ = 0;
+  min_ = highest_value_;
+  max_ = 0;
+  sum_ = 0;
+  sum_squares_ = 0;
+}
+
+int HdrHistogram::IndexFor(uint64_t value) const {
+  const int half_bits = sub_bucket_bits_ - 1;
+  const uint64_t mask = (1ull << sub_bucket_bits_) - 1;
+  const int bucket = FloorLog2(value | mask) - half_bits;
+  const uint64_t sub_bucket = value >> bucket;
+  return static_cast<int>((static_cast<uint64_t>(bucket) << half_bits) +
+                          sub_bucket);
+}
+
+uint64_t HdrHistogram::LowestValueAt(int index) const {
+  const int half_bits = sub_bucket_bits_ - 1;
+  int bucket = (index >> half_bits) - 1;
+  if (bucket < 0) bucket = 0;
+  const uint64_t sub_bucket = index - (static_cast<uint64_t>(bucket) << half_bits);
+  return sub_bucket << bucket;
+}
+
+uint64_t HdrHistogram::HighestValueAt(int index) const {
+  const int half_bits = sub_bucket_bits_ - 1;
+  int bucket = (index >> half_bits) - 1;
+  if (bucket < 0) bucket = 0;
+  return LowestValueAt(index) + (1ull << bucket) - 1;
+}
+
+void HdrHistogram::Add(uint64_t value) {
+  if (value > highest_value_) value = highest_value_;
+  if (counts_.empty()) {
+    counts_.resize(num_counts_, 0);
+  }
+  counts_[IndexFor(value)]++;
+  count_++;
+  if (value < min_) min_ = value;
+  if (value > max_) max_ = value;
+  const double v = static_cast<double>(value);
+  sum_ += v;
+  sum_squares_ += v * v;
+}
+
+void HdrHistogram::Merge(const HdrHistogram& other) {
+  assert(sub_bucket_bits_ == other.sub_bucket_bits_);
+  assert(num_counts_ == other.num_counts_);
+  if (other.count_ == 0) return;
+  if (counts_.empty()) {
+    counts_.resize(num_counts_, 0);
+  }
+  for (int i = 0; i < num_counts_; i++) {
+    counts_[i] += other.counts_[i];
+  }
+  count_ += other.count_;
+  if (other.min_ < min_) min_ = other.min_;
+  if (other.max_ > max_) max_ = other.max_;
+  sum_ += other.sum_;
+  sum_squares_ += other.sum_squares_;
+}
+
+double HdrHistogram::Average() const {
+  if (count_ == 0) return 0;
+  return sum_ / count_;
+}
+
+double HdrHistogram::StandardDeviation() const {
+  if (count_ == 0) return 0;
+  const double n = static_cast<double>(count_);
+  double variance = (sum_squares_ * n - sum_ * sum_) / (n * n);
+  return variance > 0 ? sqrt(variance) : 0;
+}
+
+uint64_t HdrHistogram::Percentile(double p) const {
+  if (count_ == 0) return 0;
+  uint64_t threshold = static_cast<uint64_t>(ceil(count_ * (p / 100.0)));
+  if (threshold < 1) threshold = 1;
+  if (threshold > count_) threshold = count_;
+  uint64_t sum = 0;
+  for (int i = 0; i < num_counts_; i++) {
+    sum += counts_[i];
+    if (sum >= threshold) {
+      uint64_t r = HighestValueAt(i);
+      if (r < min_) r = min_;
+      if (r > max_) r = max_;
+      return r;
+    }
+  }
+  return max_;
+}
+
+std::string HdrHistogram::ToString(double scale) const {
+  std::string r;
+  char buf[200];
+  snprintf(buf, sizeof(buf),
+           "Count: %llu  Average: %.4f  StdDev: %.2f\n",
+           static_cast<unsigned long long>(count_),
+           Average() / scale, StandardDeviation() / scale);
+  r.append(buf);
+  snprintf(buf, sizeof(buf),
+           "Min: %.4f  Median: %.4f  Max: %.4f\n",
+           Min() / scale, Percentile(50) / scale, Max() / scale);
+  r.append(buf);
+  r.append("Percentiles:");
+  for (int i = 0; i < kNumReportedPercentiles; i++) {
+    snprintf(buf, sizeof(buf), " P%g: %.4f", kReportedPercentiles[i],
+             Percentile(kReportedPercentiles[i]) / scale);
+    r.append(buf);
+  }
+  r.append("\n------------------------------------------------------\n");
+  if (count_ == 0) return r;
+
+  // One line per power of two; the sub-buckets are too many to print.
+  const double mult = 100.0 / count_;
+  uint64_t sum = 0;
+  int i = 0;
+  while (i < num_counts_) {
+    const int bucket = FloorLog2(HighestValueAt(i) | 1);
+    const uint64_t left = LowestValueAt(i);
+    uint64_t n = 0;
+    int j = i;
+    for (; j < num_counts_ && FloorLog2(HighestValueAt(j) | 1) == bucket; j++) {
+      n += counts_[j];
+    }
+    const uint64_t right = HighestValueAt(j - 1) + 1;
+    i = j;
+    if (n == 0) continue;
+    sum += n;
+    snprintf(buf, sizeof(buf),
+             "[ %10.1f, %10.1f ) %9llu %7.3f%% %7.3f%% ",
+             left / scale, right / scale,
+             static_cast<unsigned long long>(n), mult * n, mult * sum);
+    r.append(buf);
+
+    // Add hash marks based on percentage; 20 marks for 100%.
+    int marks = static_cast<int>(20 * (static_cast<double>(n) / count_) + 0.5);
+    r.append(marks, '#');
+    r.push_back('\n');
+  }
+  return r;
+}
+
+void HdrHistogram::ExportCSV(std::string* dst) const {
+  char buf[200];
+  dst->append("value,count,cumulative_count,percentile\n");
+  uint64_t sum = 0;
+  for (int i = 0; i < static_cast<int>(counts_.size()); i++) {
+    if (counts_[i] == 0) continue;
+    sum += counts_[i];
+    snprintf(buf, sizeof(buf), "%llu,%llu,%llu,%.6f\n",
+             static_cast<unsigned long long>(HighestValueAt(i)),
+             static_cast<unsigned long long>(counts_[i]),
+             static_cast<unsigned long long>(sum),
+             100.0 * sum / count_);
+    dst->append(buf);
+  }
+}
+
+void HdrHistogram::ExportJSON(std::string* dst) const {
+  char buf[200];
+  snprintf(buf, sizeof(buf),
+           "{\"count\": %llu, \"min\": %llu, \"max\": %llu, "
+           "\"mean\": %.3f, \"stddev\": %.3f, \"percentiles\": {",
+           static_cast<unsigned long long>(count_),
+           static_cast<unsigned long long>(Min()),
+           static_cast<unsigned long long>(Max()),
+           Average(), StandardDeviation());
+  dst->append(buf);
+  for (int i = 0; i < kNumReportedPercentiles; i++) {
+    snprintf(buf, sizeof(buf), "%s\"%g\": %llu", (i == 0 ? "" : ", "),
+             kReportedPercentiles[i],
+             static_cast<unsigned long long>(
+                 Percentile(kReportedPercentiles[i])));
+    dst->append(buf);
+  }
+  dst->append("}, \"buckets\": [");
+  bool first = true;
+  for (int i = 0; i < static_cast<int>(counts_.size()); i++) {
+    if (counts_[i] == 0) continue;
+    snprintf(buf, sizeof(buf), "%s[%llu, %llu]", (first ? "" : ", "),
+             static_cast<unsigned long long>(HighestValueAt(i)),
+             static_cast<unsigned long long>(counts_[i]));
+    dst->append(buf);
+    first = false;
+  }
+  dst->append("]}");
+}
+
+}  // namespace leveldb
@@ -0,0 +1,81 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// HdrHistogram records integer values (typically latencies in
+// nanoseconds) in log-linear buckets: every power of two is split into
+// enough linear sub-buckets that any recorded value can be read back
+// with a relative error below 10^-significant_digits.  Unlike Histogram
+// its resolution does not degrade in the tail, which makes it suitable
+// for comparing p99.9 and p99.99 latencies.
+//
+// Recording is not synchronized; keep one histogram per thread and
+// Merge() them once the threads are done.
+
+#ifndef STORAGE_LEVELDB_UTIL_HDR_HISTOGRAM_H_
+#define STORAGE_LEVELDB_UTIL_HDR_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace leveldb {
+
+class HdrHistogram {
+ public:
+  // Values up to "highest_value" (by default 60s in nanoseconds) are
+  // recorded with "significant_digits" (1..4) digits of precision;
+  // larger values are clamped to it.  The counts take about 4KB, 30KB,
+  // 210KB or 2.9MB for 1, 2, 3 or 4 digits with the default range; they
+  // are only allocated once a value is recorded.
+  explicit HdrHistogram(int significant_digits = 3,
+                        uint64_t highest_value = 60000000000ull);
+  ~HdrHistogram() { }
+
+  void Clear();
+  void Add(uint64_t value);
+
+  // Both histograms must have been created with the same parameters.
+  void Merge(const HdrHistogram& other);
+
+  uint64_t Count() const { return count_; }
+  uint64_t Min() const { return count_ == 0 ? 0 : min_; }
+  uint64_t Max() const { return max_; }
+  double Average() const;
+  double StandardDeviation() const;
+
+  // Smallest recorded value that is at least as large as "p" percent of
+  // all recorded values, up to the precision of the histogram.
+  uint64_t Percentile(double p) const;
+
+  // Summary followed by the non-empty buckets, values divided by "scale"
+  std::string ToString(double scale = 1) const;
+
+  // Append the full distribution to *dst as CSV, one non-empty bucket
+  // per line: "value,count,cumulative_count,percentile".
+  void ExportCSV(std::string* dst) const;
+
+  // Append the full distribution to *dst as a JSON object holding the
+  // summary, the usual percentiles and the non-empty buckets.
+  void ExportJSON(std::string* dst) const;
+
+ private:
+  int sub_bucket_bits_;       // log2 of the number of sub-buckets
+  uint64_t highest_value_;
+  int num_counts_;
+  std::vector<uint64_t> counts_;  // Allocated on first use
+
+  uint64_t count_;
+  uint64_t min_;
+  uint64_t max_;
+  double sum_;
+  double sum_squares_;
+
+  int IndexFor(uint64_t value) const;
+  uint64_t LowestValueAt(int index) const;
+  uint64_t HighestValueAt(int index) const;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_HDR_HISTOGRAM_H_
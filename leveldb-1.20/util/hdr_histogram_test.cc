@@ -0,0 +1,126 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/hdr_histogram.h"
+
+#include <math.h>
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class HdrHistogramTest { };
+
+// Returns true iff "actual" is within the relative precision of
+// "digits" significant digits of "expected".
+static bool Near(uint64_t actual, uint64_t expected, int digits) {
+  const double error = fabs(static_cast<double>(actual) - expected);
+  return error <= expected * pow(10.0, -digits);
+}
+
+TEST(HdrHistogramTest, Empty) {
+  HdrHistogram h;
+  ASSERT_EQ(0, h.Count());
+  ASSERT_EQ(0, h.Min());
+  ASSERT_EQ(0, h.Max());
+  ASSERT_EQ(0, h.Percentile(99));
+  ASSERT_EQ(0.0, h.Average());
+}
+
+TEST(HdrHistogramTest, SmallValuesAreExact) {
+  HdrHistogram h(3);
+  for (uint64_t v = 0; v < 1000; v++) {
+    h.Add(v);
+  }
+  ASSERT_EQ(1000, h.Count());
+  ASSERT_EQ(0, h.Min());
+  ASSERT_EQ(999, h.Max());
+  ASSERT_EQ(499, h.Percentile(50));
+  ASSERT_EQ(989, h.Percentile(99));
+  ASSERT_EQ(999, h.Percentile(100));
+}
+
+TEST(HdrHistogramTest, Precision) {
+  for (int digits = 1; digits <= 4; digits++) {
+    HdrHistogram h(digits);
+    for (uint64_t v = 1; v <= 1000000; v++) {
+      h.Add(v * 1000);
+    }
+    ASSERT_TRUE(Near(h.Percentile(50), 500000000, digits));
+    ASSERT_TRUE(Near(h.Percentile(99), 990000000, digits));
+    ASSERT_TRUE(Near(h.Percentile(99.99), 999900000, digits));
+    ASSERT_EQ(1000, h.Min());
+    ASSERT_EQ(1000000000, h.Max());
+    ASSERT_TRUE(Near(static_cast<uint64_t>(h.Average()), 500000500, 6));
+  }
+}
+
+TEST(HdrHistogramTest, Tail) {
+  // A handful of slow samples must show up in the high percentiles
+  HdrHistogram h;
+  for (int i = 0; i < 99990; i++) {
+    h.Add(1000);
+  }
+  for (int i = 0; i < 10; i++) {
+    h.Add(50000000);
+  }
+  ASSERT_TRUE(Near(h.Percentile(99.99), 1000, 3));
+  ASSERT_TRUE(Near(h.Percentile(99.999), 50000000, 3));
+}
+
+TEST(HdrHistogramTest, Clamp) {
+  HdrHistogram h(3, 1000000);
+  h.Add(5000000);
+  ASSERT_EQ(1000000, h.Max());
+  ASSERT_TRUE(Near(h.Percentile(50), 1000000, 3));
+}
+
+TEST(HdrHistogramTest, Merge) {
+  HdrHistogram all, a, b;
+  for (uint64_t v = 0; v < 100000; v++) {
+    all.Add(v * 7);
+    if (v % 3 == 0) {
+      a.Add(v * 7);
+    } else {
+      b.Add(v * 7);
+    }
+  }
+  HdrHistogram merged;
+  merged.Merge(a);
+  merged.Merge(b);
+  ASSERT_EQ(all.Count(), merged.Count());
+  ASSERT_EQ(all.Min(), merged.Min());
+  ASSERT_EQ(all.Max(), merged.Max());
+  ASSERT_EQ(all.Percentile(50), merged.Percentile(50));
+  ASSERT_EQ(all.Percentile(99.9), merged.Percentile(99.9));
+  std::string x, y;
+  all.ExportCSV(&x);
+  merged.ExportCSV(&y);
+  ASSERT_EQ(x, y);
+}
+
+TEST(HdrHistogramTest, Export) {
+  HdrHistogram h;
+  h.Add(10);
+  h.Add(10);
+  h.Add(20);
+
+  std::string csv;
+  h.ExportCSV(&csv);
+  ASSERT_EQ("value,count,cumulative_count,percentile\n"
+            "10,2,2,66.666667\n"
+            "20,1,3,100.000000\n", csv);
+
+  std::string json;
+  h.ExportJSON(&json);
+  ASSERT_TRUE(json.find("\"count\": 3") != std::string::npos) << json;
+  ASSERT_TRUE(json.find("\"50\": 10") != std::string::npos) << json;
+  ASSERT_TRUE(json.find("\"buckets\": [[10, 2], [20, 1]]") !=
+              std::string::npos) << json;
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
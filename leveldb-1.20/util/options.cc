@@ -19,11 +19,13 @@ Options::Options()
       write_buffer_size(4<<20),
       max_open_files(1000),
       block_cache(NULL),
+      metadata_cache_size(0),
       block_size(4096),
       block_restart_interval(16),
       max_file_size(2<<20),
       compression(kSnappyCompression),
       reuse_logs(false),
+      recovery_threads(1),
       filter_policy(NULL) {
 }
 
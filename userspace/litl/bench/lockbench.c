@@ -0,0 +1,346 @@
+/*
+ * Lock microbenchmark.
+ *
+ * Threads repeatedly acquire one or more pthread mutexes, touch the cache
+ * lines protected by them, release them and think for a while.  Only the
+ * pthread_mutex_* API is used, so running the benchmark through one of the
+ * lib*.sh scripts measures the interposed lock algorithm.
+ *
+ * Reported: throughput, fairness of the per-thread operation counts
+ * (Jain's index, 1 = perfectly fair) and percentiles of the time needed
+ * to acquire the locks of one operation.
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE 128
+#define CPU_PAUSE() asm volatile("pause\n" : : : "memory")
+
+/* Latency histogram: 2^SUB_BITS linear sub-buckets per power of two */
+#define SUB_BITS 5
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t max;
+} histogram_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    char *lines; /* Shared cache lines protected by the mutex */
+} __attribute__((aligned(CACHE_LINE_SIZE))) bench_lock_t;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    uint64_t ops;
+    char *private_lines;
+    unsigned long seed;
+    histogram_t hist;
+} __attribute__((aligned(CACHE_LINE_SIZE))) bench_thread_t;
+
+/* Parameters */
+static int nthreads       = 1;
+static int duration_ms    = 1000;
+static uint64_t cs_cycles = 0;
+static int shared_lines   = 1;
+static int private_lines  = 0;
+static uint64_t think_cycles = 0;
+static int nlocks         = 1;
+static int depth          = 1;
+static int pin            = 0;
+static int csv            = 0;
+static const char *label  = "";
+
+static bench_lock_t *locks;
+static volatile int start_flag = 0;
+static volatile int stop_flag  = 0;
+static double ns_per_cycle;
+
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return low | ((uint64_t)high) << 32;
+}
+
+static inline void spin_cycles(uint64_t cycles) {
+    uint64_t end = rdtsc() + cycles;
+    while (rdtsc() < end)
+        CPU_PAUSE();
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double calibrate_ns_per_cycle(void) {
+    uint64_t t0 = now_ns(), c0 = rdtsc();
+    usleep(20000);
+    uint64_t t1 = now_ns(), c1 = rdtsc();
+    return (double)(t1 - t0) / (double)(c1 - c0);
+}
+
+static inline unsigned long xorshift(unsigned long *s) {
+    unsigned long x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+/*
+ * Bucket 0 holds the values below SUB_BUCKETS exactly; bucket b > 0 holds
+ * [SUB_BUCKETS << (b - 1), SUB_BUCKETS << b) in sub-buckets 2^(b-1) wide.
+ */
+static inline int hist_index(uint64_t v) {
+    int bucket;
+    if (v < SUB_BUCKETS)
+        return (int)v;
+    bucket = 63 - __builtin_clzll(v) - SUB_BITS + 1;
+    return (bucket << SUB_BITS) +
+           (int)((v >> (bucket - 1)) & (SUB_BUCKETS - 1));
+}
+
+static inline uint64_t hist_value(int index) {
+    int bucket   = index >> SUB_BITS;
+    uint64_t sub = index & (SUB_BUCKETS - 1);
+    if (bucket == 0)
+        return sub;
+    /* Highest value of the sub-bucket */
+    return ((sub | SUB_BUCKETS) << (bucket - 1)) + (1ull << (bucket - 1)) - 1;
+}
+
+static inline void hist_add(histogram_t *h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void hist_merge(histogram_t *dst, const histogram_t *src) {
+    int i;
+    for (i = 0; i < NUM_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+static uint64_t hist_percentile(const histogram_t *h, double p) {
+    uint64_t total = 0, sum = 0, threshold;
+    int i;
+    for (i = 0; i < NUM_BUCKETS; i++)
+        total += h->counts[i];
+    if (total == 0)
+        return 0;
+    threshold = (uint64_t)ceil(total * p / 100.0);
+    if (threshold < 1)
+        threshold = 1;
+    for (i = 0; i < NUM_BUCKETS; i++) {
+        sum += h->counts[i];
+        if (sum >= threshold) {
+            uint64_t v = hist_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static inline void touch_lines(char *lines, int n) {
+    int i;
+    for (i = 0; i < n; i++)
+        (*(volatile uint64_t *)(lines + i * CACHE_LINE_SIZE))++;
+}
+
+static void *bench_thread(void *arg) {
+    bench_thread_t *t = (bench_thread_t *)arg;
+    int i;
+
+    if (pin) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(t->id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    while (!start_flag)
+        CPU_PAUSE();
+
+    while (!stop_flag) {
+        /* Nested locks are taken in index order to avoid deadlocks */
+        int first = xorshift(&t->seed) % (nlocks - depth + 1);
+
+        uint64_t start = rdtsc();
+        for (i = 0; i < depth; i++)
+            pthread_mutex_lock(&locks[first + i].mutex);
+        hist_add(&t->hist, rdtsc() - start);
+
+        touch_lines(locks[first].lines, shared_lines);
+        if (cs_cycles)
+            spin_cycles(cs_cycles);
+
+        for (i = depth - 1; i >= 0; i--)
+            pthread_mutex_unlock(&locks[first + i].mutex);
+        t->ops++;
+
+        touch_lines(t->private_lines, private_lines);
+        if (think_cycles)
+            spin_cycles(think_cycles);
+    }
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -t threads     number of threads (default 1)\n"
+            "  -d ms          duration (default 1000)\n"
+            "  -c cycles      critical-section length (default 0)\n"
+            "  -s lines       shared cache lines written in the CS (default 1)\n"
+            "  -p lines       private cache lines written outside (default 0)\n"
+            "  -w cycles      think time between operations (default 0)\n"
+            "  -l locks       number of locks (default 1)\n"
+            "  -n depth       locks held at once, nested (default 1)\n"
+            "  -a             pin thread i to cpu i\n"
+            "  -C label       print one CSV row prefixed with label\n"
+            "  -H             print the CSV header and exit\n",
+            prog);
+    exit(1);
+}
+
+static void print_csv_header(void) {
+    printf("label,threads,locks,depth,cs_cycles,shared_lines,private_lines,"
+           "think_cycles,duration_ms,ops,ops_per_sec,fairness,p50_ns,p99_ns,"
+           "p99.9_ns,p99.99_ns,max_ns\n");
+}
+
+int main(int argc, char **argv) {
+    int opt, i;
+    bench_thread_t *threads;
+    histogram_t *hist;
+    uint64_t total = 0, start, elapsed;
+    double sum_sq = 0, fairness, secs;
+
+    while ((opt = getopt(argc, argv, "t:d:c:s:p:w:l:n:aC:H")) != -1) {
+        switch (opt) {
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'd':
+            duration_ms = atoi(optarg);
+            break;
+        case 'c':
+            cs_cycles = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            shared_lines = atoi(optarg);
+            break;
+        case 'p':
+            private_lines = atoi(optarg);
+            break;
+        case 'w':
+            think_cycles = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            nlocks = atoi(optarg);
+            break;
+        case 'n':
+            depth = atoi(optarg);
+            break;
+        case 'a':
+            pin = 1;
+            break;
+        case 'C':
+            csv   = 1;
+            label = optarg;
+            break;
+        case 'H':
+            print_csv_header();
+            return 0;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (nthreads < 1 || duration_ms < 1 || shared_lines < 0 ||
+        private_lines < 0 || nlocks < 1 || depth < 1 || depth > nlocks)
+        usage(argv[0]);
+
+    ns_per_cycle = calibrate_ns_per_cycle();
+
+    if (posix_memalign((void **)&locks, CACHE_LINE_SIZE,
+                       nlocks * sizeof(bench_lock_t)) ||
+        posix_memalign((void **)&threads, CACHE_LINE_SIZE,
+                       nthreads * sizeof(bench_thread_t))) {
+        perror("posix_memalign");
+        return 1;
+    }
+    /* Interposed pthread_mutex_init() leaves the real mutex untouched */
+    memset(locks, 0, nlocks * sizeof(bench_lock_t));
+    for (i = 0; i < nlocks; i++) {
+        pthread_mutex_init(&locks[i].mutex, NULL);
+        locks[i].lines = calloc(shared_lines + 1, CACHE_LINE_SIZE);
+    }
+    memset(threads, 0, nthreads * sizeof(bench_thread_t));
+    for (i = 0; i < nthreads; i++) {
+        threads[i].id            = i;
+        threads[i].seed          = 0x9e3779b97f4a7c15ul * (i + 1);
+        threads[i].private_lines = calloc(private_lines + 1, CACHE_LINE_SIZE);
+        pthread_create(&threads[i].thread, NULL, bench_thread, &threads[i]);
+    }
+
+    start      = now_ns();
+    start_flag = 1;
+    usleep(duration_ms * 1000);
+    stop_flag = 1;
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i].thread, NULL);
+    elapsed = now_ns() - start;
+    secs    = elapsed / 1e9;
+
+    hist = calloc(1, sizeof(histogram_t));
+    for (i = 0; i < nthreads; i++) {
+        total += threads[i].ops;
+        sum_sq += (double)threads[i].ops * threads[i].ops;
+        hist_merge(hist, &threads[i].hist);
+    }
+    fairness = sum_sq > 0 ? (double)total * total / (nthreads * sum_sq) : 0;
+
+#define NS(p) ((uint64_t)(hist_percentile(hist, p) * ns_per_cycle))
+    if (csv) {
+        printf("%s,%d,%d,%d,%llu,%d,%d,%llu,%d,%llu,%.0f,%.4f,%llu,%llu,%llu,"
+               "%llu,%llu\n",
+               label, nthreads, nlocks, depth, (unsigned long long)cs_cycles,
+               shared_lines, private_lines, (unsigned long long)think_cycles,
+               duration_ms, (unsigned long long)total, total / secs, fairness,
+               (unsigned long long)NS(50), (unsigned long long)NS(99),
+               (unsigned long long)NS(99.9), (unsigned long long)NS(99.99),
+               (unsigned long long)(hist->max * ns_per_cycle));
+    } else {
+        printf("threads %d, locks %d, depth %d, cs %llu cycles, "
+               "%d shared / %d private lines, think %llu cycles\n",
+               nthreads, nlocks, depth, (unsigned long long)cs_cycles,
+               shared_lines, private_lines, (unsigned long long)think_cycles);
+        printf("ops:        %llu in %.3f s (%.0f ops/s)\n",
+               (unsigned long long)total, secs, total / secs);
+        printf("fairness:   %.4f (Jain's index)\n", fairness);
+        printf("acquire ns: p50 %llu p99 %llu p99.9 %llu p99.99 %llu "
+               "max %llu\n",
+               (unsigned long long)NS(50), (unsigned long long)NS(99),
+               (unsigned long long)NS(99.9), (unsigned long long)NS(99.99),
+               (unsigned long long)(hist->max * ns_per_cycle));
+    }
+#undef NS
+    return 0;
+}
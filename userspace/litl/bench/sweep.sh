@@ -0,0 +1,75 @@
+#!/bin/bash
+#
+# Run lockbench under every interposed lock and print one CSV table.
+#
+# Usage: ./sweep.sh [-l "libmcs_spinlock.sh libticket_original.sh ..."]
+#                   [-t "1 2 4 8"] [-r repetitions] [-- lockbench options]
+#
+# By default all ../lib*.sh scripts are used, plus "none" (the plain
+# pthread mutex, without interposition), with 1 up to nproc threads.
+# A run that does not finish within TIMEOUT seconds (default 60) is
+# reported on stderr and left out of the table.
+
+set -o pipefail
+
+BASE=$(cd "$(dirname "$0")" && pwd)
+LITL=$(dirname "$BASE")
+BENCH=$BASE/lockbench
+
+LOCKS=""
+THREADS=""
+REPS=1
+TIMEOUT=${TIMEOUT:-60}
+
+while getopts "l:t:r:" opt; do
+    case $opt in
+    l) LOCKS=$OPTARG ;;
+    t) THREADS=$OPTARG ;;
+    r) REPS=$OPTARG ;;
+    *) sed -n '3,11p' "$0" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ ! -x "$BENCH" ]; then
+    make -C "$BASE" >&2 || exit 1
+fi
+
+if [ -z "$LOCKS" ]; then
+    LOCKS="none"
+    for l in "$LITL"/lib*.sh; do
+        [ -e "$l" ] && LOCKS="$LOCKS $(basename "$l")"
+    done
+fi
+
+if [ -z "$THREADS" ]; then
+    n=$(nproc)
+    t=1
+    while [ $t -lt $n ]; do
+        THREADS="$THREADS $t"
+        t=$((t * 2))
+    done
+    THREADS="$THREADS $n"
+fi
+
+echo "lock,rep,$("$BENCH" -H | cut -d, -f2-)"
+for lock in $LOCKS; do
+    if [ "$lock" = "none" ]; then
+        run=""
+    else
+        run=$LITL/$lock
+        if [ ! -x "$run" ] || [ ! -e "$LITL/lib/$(basename "$lock" .sh).so" ]; then
+            echo "skipping $lock: not built" >&2
+            continue
+        fi
+    fi
+    for t in $THREADS; do
+        for rep in $(seq 1 "$REPS"); do
+            # The libraries may print a banner before the results
+            row=$(timeout "$TIMEOUT" $run "$BENCH" -t "$t" "$@" \
+                  -C "$(basename "$lock" .sh)" | tail -n 1) ||
+                { echo "$lock with $t threads failed" >&2; continue; }
+            echo "$(basename "$lock" .sh),$rep,$row" | cut -d, -f1,2,4-
+        done
+    done
+done
@@ -0,0 +1,86 @@
+#ifndef __ADAPTIVE_H__
+#define __ADAPTIVE_H__
+
+#include <stdint.h>
+#include "padding.h"
+#define LOCK_ALGORITHM "ADAPTIVE"
+#define NEED_CONTEXT 0
+#define SUPPORT_WAITING 1
+
+// Contention score (see src/adaptive.c): the lock switches to the queue mode
+// when the score reaches ADAPTIVE_TO_QUEUE and back to test-and-set when it
+// falls to ADAPTIVE_TO_TAS.  Every contended acquisition adds the number of
+// failed attempts (at most ADAPTIVE_MAX_FAILURES), every uncontended one
+// subtracts 1.
+#define ADAPTIVE_MAX_SCORE 256
+#define ADAPTIVE_TO_QUEUE 128
+#define ADAPTIVE_TO_TAS 16
+#define ADAPTIVE_MAX_FAILURES 8
+
+#define ADAPTIVE_MODE_TAS 0
+#define ADAPTIVE_MODE_QUEUE 1
+
+typedef struct adaptive_node {
+    struct adaptive_node *volatile next;
+    char __pad[pad_to_cache_line(sizeof(struct adaptive_node *))];
+    volatile int spin __attribute__((aligned(L_CACHE_LINE_SIZE)));
+} adaptive_node_t __attribute__((aligned(L_CACHE_LINE_SIZE)));
+
+typedef struct adaptive_mutex {
+    volatile uint8_t locked __attribute__((aligned(L_CACHE_LINE_SIZE)));
+    volatile uint8_t mode;
+    uint16_t score; // Only written by the lock holder
+    char __pad[pad_to_cache_line(sizeof(uint8_t) * 2 + sizeof(uint16_t))];
+    struct adaptive_node *volatile tail
+        __attribute__((aligned(L_CACHE_LINE_SIZE)));
+#if COND_VAR
+    pthread_mutex_t posix_lock;
+#endif
+} adaptive_mutex_t __attribute__((aligned(L_CACHE_LINE_SIZE)));
+
+typedef pthread_cond_t adaptive_cond_t;
+typedef void *adaptive_context_t; // Unused, take the less space as possible
+
+adaptive_mutex_t *adaptive_mutex_create(const pthread_mutexattr_t *attr);
+int adaptive_mutex_lock(adaptive_mutex_t *impl, adaptive_context_t *me);
+int adaptive_mutex_trylock(adaptive_mutex_t *impl, adaptive_context_t *me);
+void adaptive_mutex_unlock(adaptive_mutex_t *impl, adaptive_context_t *me);
+int adaptive_mutex_destroy(adaptive_mutex_t *lock);
+int adaptive_cond_init(adaptive_cond_t *cond, const pthread_condattr_t *attr);
+int adaptive_cond_timedwait(adaptive_cond_t *cond, adaptive_mutex_t *lock,
+                            adaptive_context_t *me, const struct timespec *ts);
+int adaptive_cond_wait(adaptive_cond_t *cond, adaptive_mutex_t *lock,
+                       adaptive_context_t *me);
+int adaptive_cond_signal(adaptive_cond_t *cond);
+int adaptive_cond_broadcast(adaptive_cond_t *cond);
+int adaptive_cond_destroy(adaptive_cond_t *cond);
+void adaptive_thread_start(void);
+void adaptive_thread_exit(void);
+void adaptive_application_init(void);
+void adaptive_application_exit(void);
+void adaptive_init_context(adaptive_mutex_t *impl, adaptive_context_t *context,
+                           int number);
+
+typedef adaptive_mutex_t lock_mutex_t;
+typedef adaptive_context_t lock_context_t;
+typedef adaptive_cond_t lock_cond_t;
+
+// Define library function ptr
+#define lock_mutex_create adaptive_mutex_create
+#define lock_mutex_lock adaptive_mutex_lock
+#define lock_mutex_trylock adaptive_mutex_trylock
+#define lock_mutex_unlock adaptive_mutex_unlock
+#define lock_mutex_destroy adaptive_mutex_destroy
+#define lock_cond_init adaptive_cond_init
+#define lock_cond_timedwait adaptive_cond_timedwait
+#define lock_cond_wait adaptive_cond_wait
+#define lock_cond_signal adaptive_cond_signal
+#define lock_cond_broadcast adaptive_cond_broadcast
+#define lock_cond_destroy adaptive_cond_destroy
+#define lock_thread_start adaptive_thread_start
+#define lock_thread_exit adaptive_thread_exit
+#define lock_application_init adaptive_application_init
+#define lock_application_exit adaptive_application_exit
+#define lock_init_context adaptive_init_context
+
+#endif // __ADAPTIVE_H__
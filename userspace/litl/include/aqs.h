@@ -30,6 +30,7 @@
 #define LOCK_ALGORITHM "AQS"
 #define NEED_CONTEXT 1
 #define SUPPORT_WAITING 1
+#define SUPPORT_RESTRICTION 1
 
 /*
  * Bit manipulation (not used currently)
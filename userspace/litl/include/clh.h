@@ -28,6 +28,7 @@
 #define LOCK_ALGORITHM "CLH"
 #define NEED_CONTEXT 1
 #define SUPPORT_WAITING 1
+#define SUPPORT_RESTRICTION 1
 
 // CLH variant with standard interface from M.L.Scott
 
@@ -7,6 +7,7 @@
 #define LOCK_ALGORITHM "KOMB"
 #define NEED_CONTEXT 0
 #define SUPPORT_WAITING 1
+#define SUPPORT_RESTRICTION 1
 
 /* Arch utility */
 static inline void smp_rmb(void) {
@@ -97,7 +98,16 @@ static inline void __read_once_size(volatile void *p, void *res, int size) {
 typedef struct komb_mutex {
     struct komb_node *volatile tail;
     int locked;
-    char __pad2[pad_to_cache_line(sizeof(uint32_t))];
+    int served; // Critical sections run by the server thread (komb_mutex_serve)
+    // Lines around the application mutex, and those written by the critical
+    // sections, prefetched by the combiner (see komb_prefetch_begin)
+    char *window;
+    uint16_t window_lines;
+    uint16_t hot_lines;
+    uint16_t last_written;
+    uint16_t batches;
+    char __pad2[pad_to_cache_line(sizeof(struct komb_node *) + sizeof(char *) +
+                                  sizeof(uint32_t) * 2 + sizeof(uint16_t) * 4)];
 #if COND_VAR
     pthread_mutex_t posix_lock;
     char __pad3[pad_to_cache_line(sizeof(pthread_mutex_t))];
@@ -112,7 +122,8 @@ typedef struct komb_node {
     void *rsp;
     komb_mutex_t *lock;
     volatile int wait;
-    char dummy1[20];
+    int hw_cpu; // CPU the waiter enqueued from (see komb_distance)
+    char dummy1[16];
 
     union {
         struct {
@@ -121,7 +132,12 @@ typedef struct komb_node {
         };
         uint16_t locked_completed;
     };
-    char dummy2[48];
+    // Closure of a delegated critical section (see komb_mutex_delegate),
+    // NULL for the waiters whose stack the combiner switches to
+    void *(*fn)(void *);
+    void *arg;
+    void *ret;
+    char dummy2[24];
 } komb_node_t __attribute__((aligned(L_CACHE_LINE_SIZE)));
 
 typedef pthread_cond_t komb_cond_t;
@@ -130,6 +146,10 @@ int komb_mutex_lock(komb_mutex_t *impl, komb_node_t *me);
 int komb_mutex_trylock(komb_mutex_t *impl, komb_node_t *me);
 void komb_mutex_unlock(komb_mutex_t *impl, komb_node_t *me);
 int komb_mutex_destroy(komb_mutex_t *lock);
+void *komb_mutex_delegate(komb_mutex_t *impl, void *(*fn)(void *), void *arg);
+int komb_mutex_serve(komb_mutex_t *impl);
+void komb_mutex_attach(komb_mutex_t *impl, void *mutex);
+void komb_before_blocking(void);
 int komb_cond_init(komb_cond_t *cond, const pthread_condattr_t *attr);
 int komb_cond_timedwait(komb_cond_t *cond, komb_mutex_t *lock, komb_node_t *me,
                         const struct timespec *ts);
@@ -152,6 +172,10 @@ typedef komb_cond_t lock_cond_t;
 #define lock_mutex_trylock komb_mutex_trylock
 #define lock_mutex_unlock komb_mutex_unlock
 #define lock_mutex_destroy komb_mutex_destroy
+#define lock_mutex_delegate komb_mutex_delegate
+#define lock_mutex_serve komb_mutex_serve
+#define lock_mutex_attach komb_mutex_attach
+#define lock_before_blocking komb_before_blocking
 #define lock_cond_init komb_cond_init
 #define lock_cond_timedwait komb_cond_timedwait
 #define lock_cond_wait komb_cond_wait
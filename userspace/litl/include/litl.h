@@ -0,0 +1,39 @@
+#ifndef __LITL_H__
+#define __LITL_H__
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Runs fn(arg) with mutex held and returns its result.
+ *
+ * With a delegation lock (KOMB), a contended call queues the closure on the
+ * lock and the combiner calls it directly, instead of switching to the stack
+ * of the caller as for a transparent pthread_mutex_lock. Both kinds of
+ * requests can be mixed on the same lock. fn may run on another thread: it
+ * must not depend on thread-local state nor wait on a condition variable
+ * with mutex. With the other locks, this is lock, fn(arg), unlock.
+ *
+ * Applications that must also run without LiTL can declare the function weak
+ * (#pragma weak litl_delegate) and lock the mutex themselves when it is NULL.
+ */
+void *litl_delegate(pthread_mutex_t *mutex, void *(*fn)(void *), void *arg);
+
+/*
+ * Hands all the critical sections of mutex to a server thread pinned on one
+ * CPU (LITL_KOMB_SERVER_CPU, the last one by default), so that the data it
+ * protects stays in the caches of this CPU. The server is started by the
+ * first call. mutex must not be held by the caller. Returns 0 on success,
+ * ENOSPC if too many mutexes are already served, and ENOTSUP if the lock
+ * algorithm has no server mode (only KOMB has one).
+ */
+int litl_serve(pthread_mutex_t *mutex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __LITL_H__
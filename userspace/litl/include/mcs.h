@@ -28,10 +28,22 @@
 #define LOCK_ALGORITHM "MCS"
 #define NEED_CONTEXT 1
 #define SUPPORT_WAITING 1
+#define SUPPORT_RESTRICTION 1
+
+// States of a queue node, for pthread_mutex_timedlock (see src/mcs.c)
+#define MCS_IDLE 0
+#define MCS_WAITING 1
+#define MCS_GRANTED 2
+#define MCS_ABANDONED 3
+#define MCS_SKIPPED 4
+
+// Iterations between two reads of the clock by a timed waiter
+#define MCS_TIMEDLOCK_CHECK 128
 
 typedef struct mcs_node {
     struct mcs_node *volatile next;
-    char __pad[pad_to_cache_line(sizeof(struct mcs_node *))];
+    volatile int state;
+    char __pad[pad_to_cache_line(sizeof(struct mcs_node *) + sizeof(int))];
     volatile int spin __attribute__((aligned(L_CACHE_LINE_SIZE)));
 } mcs_node_t __attribute__((aligned(L_CACHE_LINE_SIZE)));
 
@@ -47,6 +59,8 @@ typedef pthread_cond_t mcs_cond_t;
 mcs_mutex_t *mcs_mutex_create(const pthread_mutexattr_t *attr);
 int mcs_mutex_lock(mcs_mutex_t *impl, mcs_node_t *me);
 int mcs_mutex_trylock(mcs_mutex_t *impl, mcs_node_t *me);
+int mcs_mutex_timedlock(mcs_mutex_t *impl, mcs_node_t *me,
+                        const struct timespec *abstime);
 void mcs_mutex_unlock(mcs_mutex_t *impl, mcs_node_t *me);
 int mcs_mutex_destroy(mcs_mutex_t *lock);
 int mcs_cond_init(mcs_cond_t *cond, const pthread_condattr_t *attr);
@@ -69,6 +83,7 @@ typedef mcs_cond_t lock_cond_t;
 #define lock_mutex_create mcs_mutex_create
 #define lock_mutex_lock mcs_mutex_lock
 #define lock_mutex_trylock mcs_mutex_trylock
+#define lock_mutex_timedlock mcs_mutex_timedlock
 #define lock_mutex_unlock mcs_mutex_unlock
 #define lock_mutex_destroy mcs_mutex_destroy
 #define lock_cond_init mcs_cond_init
@@ -0,0 +1,294 @@
+/*
+ * Lock design summary:
+ * A lock that changes its waiting strategy with the contention it observes,
+ * so that lightly-used locks stay as cheap as a test-and-set while the hot
+ * ones get a queue.
+ * The lock itself is always a single byte, taken with a compare-and-swap;
+ * only the way waiters compete for it changes:
+ * - In test-and-set mode, waiters spin on the byte (test-and-test-and-set).
+ * - In queue mode, waiters first enqueue in an MCS queue, and only the head
+ *   of the queue spins on the byte. Once it has the lock, the head leaves the
+ *   queue and wakes its successor, which becomes the new head (this is the
+ *   Linux qspinlock design). A thread's queue node is therefore only used
+ *   while it is acquiring a lock, so one node per thread is enough.
+ * Since the byte is the lock in both modes, switching the mode never needs
+ * to drain anything: threads spinning in test-and-set mode move to the queue
+ * when they see the new mode, and queued threads keep going.
+ * The lock holder keeps a contention score: every contended acquisition
+ * adds its number of failed attempts, every uncontended one subtracts 1.
+ * The lock moves to the queue mode when the score gets high, and back when it
+ * gets low (see adaptive.h for the thresholds); the gap between the two
+ * avoids switching back and forth.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <assert.h>
+#include <adaptive.h>
+
+#include "waiting_policy.h"
+#include "interpose.h"
+#include "utils.h"
+
+extern __thread unsigned int cur_thread_id;
+
+static __thread adaptive_node_t my_node;
+
+static unsigned long switches_to_queue;
+static unsigned long switches_to_tas;
+
+adaptive_mutex_t *adaptive_mutex_create(const pthread_mutexattr_t *attr) {
+    adaptive_mutex_t *impl =
+        (adaptive_mutex_t *)alloc_cache_align(sizeof(adaptive_mutex_t));
+    impl->locked = 0;
+    impl->mode   = ADAPTIVE_MODE_TAS;
+    impl->score  = 0;
+    impl->tail   = NULL;
+#if COND_VAR
+    REAL(pthread_mutex_init)(&impl->posix_lock, attr);
+#endif
+
+    return impl;
+}
+
+static inline int adaptive_try(adaptive_mutex_t *impl) {
+    return impl->locked == 0 &&
+           __sync_bool_compare_and_swap(&impl->locked, 0, 1);
+}
+
+// Called by the new lock holder
+static inline void adaptive_account(adaptive_mutex_t *impl,
+                                    unsigned int failures) {
+    int score = impl->score;
+
+    if (failures == 0) {
+        if (score == 0)
+            return;
+        score--;
+    } else {
+        score += failures < ADAPTIVE_MAX_FAILURES ? failures
+                                                  : ADAPTIVE_MAX_FAILURES;
+        if (score > ADAPTIVE_MAX_SCORE)
+            score = ADAPTIVE_MAX_SCORE;
+    }
+    impl->score = score;
+
+    if (impl->mode == ADAPTIVE_MODE_TAS && score >= ADAPTIVE_TO_QUEUE) {
+        impl->mode = ADAPTIVE_MODE_QUEUE;
+        __sync_fetch_and_add(&switches_to_queue, 1);
+        DEBUG("[%d] lock=%p switches to the queue mode\n", cur_thread_id,
+              impl);
+    } else if (impl->mode == ADAPTIVE_MODE_QUEUE && score <= ADAPTIVE_TO_TAS) {
+        impl->mode = ADAPTIVE_MODE_TAS;
+        __sync_fetch_and_add(&switches_to_tas, 1);
+        DEBUG("[%d] lock=%p switches to the test-and-set mode\n",
+              cur_thread_id, impl);
+    }
+}
+
+static int __adaptive_mutex_lock(adaptive_mutex_t *impl) {
+    adaptive_node_t *me = &my_node, *pred, *succ;
+    unsigned int failures;
+
+    if (adaptive_try(impl)) {
+        adaptive_account(impl, 0);
+        return 0;
+    }
+    failures = 1;
+
+    while (impl->mode == ADAPTIVE_MODE_TAS) {
+        while (impl->locked && impl->mode == ADAPTIVE_MODE_TAS)
+            CPU_PAUSE();
+        if (adaptive_try(impl)) {
+            adaptive_account(impl, failures);
+            return 0;
+        }
+        failures++;
+    }
+
+    me->next = NULL;
+    me->spin = LOCKED;
+
+    pred = xchg_64((void *)&impl->tail, (void *)me);
+    if (pred) {
+        pred->next = me;
+        COMPILER_BARRIER();
+        waiting_policy_sleep(&me->spin);
+        failures++;
+    }
+
+    // Head of the queue
+    while (!adaptive_try(impl)) {
+        while (impl->locked)
+            CPU_PAUSE();
+        failures++;
+    }
+
+    // Leave the queue
+    succ = me->next;
+    if (!succ) {
+        if (__sync_val_compare_and_swap(&impl->tail, me, NULL) == me)
+            goto out;
+
+        /* Wait for successor to appear */
+        while (!(succ = me->next))
+            CPU_PAUSE();
+    }
+    waiting_policy_wake(&succ->spin);
+
+out:
+    adaptive_account(impl, failures);
+    return 0;
+}
+
+int adaptive_mutex_lock(adaptive_mutex_t *impl,
+                        adaptive_context_t *UNUSED(me)) {
+    int ret = __adaptive_mutex_lock(impl);
+    assert(ret == 0);
+#if COND_VAR
+    if (ret == 0) {
+        DEBUG_PTHREAD("[%d] Lock posix=%p\n", cur_thread_id, &impl->posix_lock);
+        assert(REAL(pthread_mutex_lock)(&impl->posix_lock) == 0);
+    }
+#endif
+    return ret;
+}
+
+int adaptive_mutex_trylock(adaptive_mutex_t *impl,
+                           adaptive_context_t *UNUSED(me)) {
+    if (adaptive_try(impl)) {
+        adaptive_account(impl, 0);
+#if COND_VAR
+        int ret = 0;
+        while ((ret = REAL(pthread_mutex_trylock)(&impl->posix_lock)) == EBUSY)
+            CPU_PAUSE();
+
+        assert(ret == 0);
+#endif
+        return 0;
+    }
+
+    return EBUSY;
+}
+
+static void __adaptive_mutex_unlock(adaptive_mutex_t *impl) {
+    COMPILER_BARRIER();
+    impl->locked = 0;
+}
+
+void adaptive_mutex_unlock(adaptive_mutex_t *impl,
+                           adaptive_context_t *UNUSED(me)) {
+#if COND_VAR
+    int ret = REAL(pthread_mutex_unlock)(&impl->posix_lock);
+    assert(ret == 0);
+#endif
+    __adaptive_mutex_unlock(impl);
+}
+
+int adaptive_mutex_destroy(adaptive_mutex_t *lock) {
+#if COND_VAR
+    REAL(pthread_mutex_destroy)(&lock->posix_lock);
+#endif
+    free(lock);
+    lock = NULL;
+
+    return 0;
+}
+
+int adaptive_cond_init(adaptive_cond_t *cond, const pthread_condattr_t *attr) {
+#if COND_VAR
+    return REAL(pthread_cond_init)(cond, attr);
+#else
+    fprintf(stderr, "Error cond_var not supported.");
+    assert(0);
+#endif
+}
+
+int adaptive_cond_timedwait(adaptive_cond_t *cond, adaptive_mutex_t *lock,
+                            adaptive_context_t *me, const struct timespec *ts) {
+#if COND_VAR
+    int res;
+
+    __adaptive_mutex_unlock(lock);
+
+    if (ts)
+        res = REAL(pthread_cond_timedwait)(cond, &lock->posix_lock, ts);
+    else
+        res = REAL(pthread_cond_wait)(cond, &lock->posix_lock);
+
+    if (res != 0 && res != ETIMEDOUT) {
+        fprintf(stderr, "Error on cond_{timed,}wait %d\n", res);
+        assert(0);
+    }
+
+    int ret = 0;
+    if ((ret = REAL(pthread_mutex_unlock)(&lock->posix_lock)) != 0) {
+        fprintf(stderr, "Error on mutex_unlock %d\n", ret == EPERM);
+        assert(0);
+    }
+
+    adaptive_mutex_lock(lock, me);
+
+    return res;
+#else
+    fprintf(stderr, "Error cond_var not supported.");
+    assert(0);
+#endif
+}
+
+int adaptive_cond_wait(adaptive_cond_t *cond, adaptive_mutex_t *lock,
+                       adaptive_context_t *me) {
+    return adaptive_cond_timedwait(cond, lock, me, 0);
+}
+
+int adaptive_cond_signal(adaptive_cond_t *cond) {
+#if COND_VAR
+    return REAL(pthread_cond_signal)(cond);
+#else
+    fprintf(stderr, "Error cond_var not supported.");
+    assert(0);
+#endif
+}
+
+int adaptive_cond_broadcast(adaptive_cond_t *cond) {
+#if COND_VAR
+    return REAL(pthread_cond_broadcast)(cond);
+#else
+    fprintf(stderr, "Error cond_var not supported.");
+    assert(0);
+#endif
+}
+
+int adaptive_cond_destroy(adaptive_cond_t *cond) {
+#if COND_VAR
+    return REAL(pthread_cond_destroy)(cond);
+#else
+    fprintf(stderr, "Error cond_var not supported.");
+    assert(0);
+#endif
+}
+
+void adaptive_thread_start(void) {
+}
+
+void adaptive_thread_exit(void) {
+}
+
+void adaptive_application_init(void) {
+}
+
+void adaptive_application_exit(void) {
+    // Never on stdout: that is the output of the interposed application
+    DEBUG("Adaptive: %lu switches to the queue mode, %lu back to "
+          "test-and-set\n",
+          switches_to_queue, switches_to_tas);
+}
+
+void adaptive_init_context(lock_mutex_t *UNUSED(impl),
+                           lock_context_t *UNUSED(context),
+                           int UNUSED(number)) {
+}
@@ -507,6 +507,10 @@ int aqs_mutex_lock(aqs_mutex_t *impl, aqs_node_t *me) {
 }
 
 int aqs_mutex_trylock(aqs_mutex_t *impl, aqs_node_t *me) {
+    // Fail without an atomic instruction while the lock is busy, as
+    // pthread_mutex_timedlock spins on trylock
+    if (READ_ONCE(impl->locked))
+        return EBUSY;
 
     if ((smp_cas(&impl->locked, 0, 1) == 0)) {
 #if COND_VAR
@@ -34,6 +34,9 @@
 #include <stdio.h>
 
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -124,6 +127,8 @@
 #include <komb.h>
 #elif defined(KOMBMTX)
 #include <kombmtx.h>
+#elif defined(ADAPTIVE)
+#include <adaptive.h>
 #else
 #error "No lock algorithm known"
 #endif
@@ -131,14 +136,22 @@
 #include "interpose.h"
 #include "utils.h"
 #include "waiting_policy.h"
+#include "restriction.h"
+#include <litl.h>
 #include <string.h>
 
 // The NO_INDIRECTION flag allows disabling the pthread-to-lock hash table
 // and directly calling the specific lock function
 // See empty.c for example.
 
+// Thread IDs are dense and recycled: a new thread takes the lowest free ID and
+// gives it back when it exits (see thread_id_release), so MAX_THREADS bounds
+// the number of live threads rather than the number of threads ever created.
+// last_thread_id is the highest ID handed out so far, plus one.
 unsigned int last_thread_id;
 __thread unsigned int cur_thread_id;
+static volatile uint64_t thread_id_map[MAX_THREADS / 64];
+static pthread_key_t thread_id_key;
 __thread struct t_info tinfo;
 __thread uint8_t lock_level;
 
@@ -165,6 +178,134 @@ __thread unsigned int lock_status;
 
 #define MAX_COUNT (1 << 25)
 
+#ifndef PERF_COUNTERS
+#define PERF_COUNTERS 0
+#endif
+
+#if PERF_COUNTERS
+#include "perf_counters.h"
+#define perf_log_phase(i, c) perf_counters_phase(i, c)
+#else
+#define perf_log_phase(i, c)                                                   \
+    do {                                                                       \
+    } while (0)
+#endif
+
+#include "sspfd_phases.h"
+
+#if SSPFD_PHASES
+__thread uint64_t *sspfd_phase_count;
+static volatile ticks **sspfd_thread_stores[MAX_THREADS];
+static uint64_t *sspfd_thread_counts[MAX_THREADS];
+static volatile ticks *sspfd_thread_starts[MAX_THREADS];
+static ticks sspfd_thread_corrections[MAX_THREADS];
+static const char *sspfd_phase_names[SSPFD_NUM_PHASES] = {
+    "lock", "unlock", "join", "wait", "combine", "handoff"};
+
+static void sspfd_thread_init(void) {
+    uint64_t *count;
+
+    // A thread reusing an ID keeps filling the stores of the previous ones
+    if (sspfd_thread_stores[cur_thread_id] != NULL) {
+        sspfd_num_stores  = SSPFD_NUM_PHASES;
+        sspfd_store       = sspfd_thread_stores[cur_thread_id];
+        _sspfd_s          = sspfd_thread_starts[cur_thread_id];
+        sspfd_correction  = sspfd_thread_corrections[cur_thread_id];
+        sspfd_phase_count = sspfd_thread_counts[cur_thread_id];
+        return;
+    }
+
+    count = calloc(SSPFD_NUM_PHASES, sizeof(uint64_t));
+    if (count == NULL) {
+        fprintf(stderr, "Unable to allocate the sspfd counters\n");
+        exit(-1);
+    }
+
+    SSPFDINIT(SSPFD_NUM_PHASES, SSPFD_ENTRIES, cur_thread_id);
+    sspfd_thread_stores[cur_thread_id]      = sspfd_store;
+    sspfd_thread_starts[cur_thread_id]      = _sspfd_s;
+    sspfd_thread_corrections[cur_thread_id] = sspfd_correction;
+    sspfd_thread_counts[cur_thread_id]      = count;
+    sspfd_phase_count                       = count;
+}
+
+static inline void sspfd_log_phase(uint8_t csphase, uint8_t phase) {
+    // Only blocking requests are timed: a failed trylock never reaches
+    // AFTER_ENTER_CS
+    int trylock = phase == PHASE_TRYLOCK || phase == PHASE_RD_TRYLOCK;
+
+    switch (csphase) {
+    case BEFORE_ENTER_CS:
+        if (!trylock)
+            sspfd_phase_begin(SSPFD_LOCK);
+        break;
+    case AFTER_ENTER_CS:
+        if (!trylock)
+            sspfd_phase_end(SSPFD_LOCK);
+        break;
+    case BEFORE_EXIT_CS:
+        sspfd_phase_begin(SSPFD_UNLOCK);
+        break;
+    case AFTER_EXIT_CS:
+        sspfd_phase_end(SSPFD_UNLOCK);
+        break;
+    }
+}
+
+static void sspfd_report(void) {
+    volatile ticks **own = sspfd_store;
+    volatile ticks *merged[SSPFD_NUM_PHASES];
+    int nthreads = last_thread_id < MAX_THREADS ? last_thread_id : MAX_THREADS;
+    uint64_t taken, kept, n, c;
+    sspfd_stats_t stats;
+    int i, p;
+
+    // The merged samples replace this thread's stores, which must not be
+    // written anymore
+    sspfd_phase_count = NULL;
+    sspfd_store       = merged;
+
+    for (p = 0; p < SSPFD_NUM_PHASES; p++) {
+        taken = kept = 0;
+        for (i = 0; i < nthreads; i++) {
+            if (sspfd_thread_counts[i] == NULL)
+                continue;
+            c = sspfd_thread_counts[i][p];
+            taken += c;
+            kept += c < SSPFD_ENTRIES ? c : SSPFD_ENTRIES;
+        }
+        if (kept == 0)
+            continue;
+
+        merged[p] = malloc(kept * sizeof(ticks));
+        if (merged[p] == NULL)
+            continue;
+        n = 0;
+        for (i = 0; i < nthreads; i++) {
+            if (sspfd_thread_counts[i] == NULL)
+                continue;
+            c = sspfd_thread_counts[i][p];
+            c = c < SSPFD_ENTRIES ? c : SSPFD_ENTRIES;
+            memcpy((void *)&merged[p][n], (void *)sspfd_thread_stores[i][p],
+                   c * sizeof(ticks));
+            n += c;
+        }
+
+        printf("\n#### sspfd %s phase (cycles): %lu samples kept out of %lu\n",
+               sspfd_phase_names[p], kept, taken);
+        sspfd_get_stats(p, kept, &stats);
+        sspfd_print_stats(&stats);
+        free((void *)merged[p]);
+    }
+
+    sspfd_store = own;
+}
+#else
+#define sspfd_log_phase(c, p)                                                  \
+    do {                                                                       \
+    } while (0)
+#endif
+
 struct cstime {
     uint8_t phase;
     uint8_t csphase;
@@ -189,17 +330,62 @@ int active[MAX_THREADS] = {0};
 #endif
 
 #if !NO_INDIRECTION
+#if NEED_CONTEXT
+// The contexts of a lock are allocated by chunks of LOCK_CONTEXT_CHUNK thread
+// IDs, the first time a thread of the chunk uses the lock (see
+// lock_context_get). As thread IDs are dense, a lock only has contexts for the
+// threads that are alive (or were) instead of MAX_THREADS of them.
+#define LOCK_CONTEXT_CHUNK 32
+#define LOCK_CONTEXT_CHUNKS (MAX_THREADS / LOCK_CONTEXT_CHUNK)
+#endif
+
 typedef struct {
     lock_mutex_t *lock_lock;
     char __pad[pad_to_cache_line(sizeof(lock_mutex_t *))];
 #if NEED_CONTEXT
-    lock_context_t *lock_node;
-    /* lock_context_t lock_node[MAX_THREADS]; */
+    lock_context_t *volatile lock_node[LOCK_CONTEXT_CHUNKS];
+#endif
+#if SUPPORT_RESTRICTION
+    restriction_t restriction __attribute__((aligned(L_CACHE_LINE_SIZE)));
 #endif
 } lock_transparent_mutex_t;
 
+#if SUPPORT_RESTRICTION
+int restriction_limit;
+__thread restriction_node_t restriction_node;
+#endif
+
 // pthread-to-lock htable (using CLHT)
 static clht_t *pthread_to_lock;
+
+// CLHT sets up garbage-collection state (including a memory allocator) for
+// each thread. It is kept for the next threads that get the same ID.
+extern __thread struct ssmem_allocator *clht_alloc;
+extern __thread struct ht_ts *clht_ts_thread;
+extern __thread volatile struct ssmem_ts *ssmem_ts_local;
+void clht_gc_thread_version_max(void);
+
+typedef struct {
+    struct ssmem_allocator *alloc;
+    struct ht_ts *ts;
+    volatile struct ssmem_ts *ssmem_ts;
+} clht_thread_t;
+static clht_thread_t clht_threads[MAX_THREADS];
+
+static void clht_thread_init(void) {
+    clht_thread_t *t = &clht_threads[cur_thread_id];
+
+    if (t->alloc == NULL) {
+        clht_gc_thread_init(pthread_to_lock, cur_thread_id);
+        t->alloc    = clht_alloc;
+        t->ts       = clht_ts_thread;
+        t->ssmem_ts = ssmem_ts_local;
+    } else {
+        clht_alloc     = t->alloc;
+        clht_ts_thread = t->ts;
+        ssmem_ts_local = t->ssmem_ts;
+    }
+}
 #endif
 
 struct routine {
@@ -222,14 +408,50 @@ struct routine {
 #endif
 
 #if !NO_INDIRECTION
+#if NEED_CONTEXT
+static lock_context_t *__attribute__((noinline))
+lock_context_alloc(void *lock, lock_context_t *volatile *chunks) {
+    lock_context_t *chunk =
+        alloc_cache_align(LOCK_CONTEXT_CHUNK * sizeof(lock_context_t));
+    memset(chunk, 0, LOCK_CONTEXT_CHUNK * sizeof(lock_context_t));
+    lock_init_context(lock, chunk, LOCK_CONTEXT_CHUNK);
+
+    // Another thread of the chunk may have allocated it concurrently
+    if (!__sync_bool_compare_and_swap(chunks, NULL, chunk)) {
+        free(chunk);
+        chunk = *chunks;
+    }
+    return chunk;
+}
+
+static inline lock_context_t *
+lock_context_get(void *lock, lock_context_t *volatile *chunks) {
+    lock_context_t *chunk = chunks[cur_thread_id / LOCK_CONTEXT_CHUNK];
+    if (chunk == NULL)
+        chunk = lock_context_alloc(lock,
+                                   &chunks[cur_thread_id / LOCK_CONTEXT_CHUNK]);
+    return &chunk[cur_thread_id % LOCK_CONTEXT_CHUNK];
+}
+
+static void lock_context_free(lock_context_t *volatile *chunks) {
+    int i;
+    for (i = 0; i < LOCK_CONTEXT_CHUNKS; i++)
+        free(chunks[i]);
+}
+#endif
+
 static lock_transparent_mutex_t *
 ht_lock_create(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr) {
     lock_transparent_mutex_t *impl = alloc_cache_align(sizeof *impl);
     impl->lock_lock                = lock_mutex_create(attr);
+#ifdef lock_mutex_attach
+    lock_mutex_attach(impl->lock_lock, mutex);
+#endif
 #if NEED_CONTEXT
-    impl->lock_node = alloc_cache_align(MAX_THREADS * sizeof(lock_context_t));
-    memset(impl->lock_node, 0, MAX_THREADS * sizeof(lock_context_t));
-    lock_init_context(impl->lock_lock, impl->lock_node, MAX_THREADS);
+    memset((void *)impl->lock_node, 0, sizeof(impl->lock_node));
+#endif
+#if SUPPORT_RESTRICTION
+    restriction_init(&impl->restriction);
 #endif
 
     // If a lock is initialized statically and two threads acquire the locks at
@@ -324,10 +546,69 @@ int (*REAL(pthread_rwlock_trywrlock))(pthread_rwlock_t *lock)
 int (*REAL(pthread_rwlock_unlock))(pthread_rwlock_t *lock)
     __attribute__((aligned(L_CACHE_LINE_SIZE)));
 
+#ifdef lock_before_blocking
+// Calls that may block, interposed so that the lock can avoid stalling the
+// threads it runs critical sections for. Loaded on first use, as they may be
+// called while the library is initialized.
+int (*REAL(fsync))(int fd);
+int (*REAL(fdatasync))(int fd);
+int (*REAL(nanosleep))(const struct timespec *req, struct timespec *rem);
+int (*REAL(usleep))(useconds_t usec);
+int (*REAL(poll))(struct pollfd *fds, nfds_t nfds, int timeout);
+#endif
+
 #if CLEANUP_ON_SIGNAL
 static void signal_exit(int signo);
 #endif
 
+static unsigned int thread_id_acquire(void) {
+    unsigned int i, id, last;
+    uint64_t word;
+
+    for (i = 0; i < MAX_THREADS / 64; i++) {
+        while ((word = thread_id_map[i]) != ~0UL) {
+            id = i * 64 + __builtin_ctzl(~word);
+            if (!__sync_bool_compare_and_swap(&thread_id_map[i], word,
+                                              word | (1UL << (id % 64))))
+                continue;
+
+            while ((last = last_thread_id) <= id &&
+                   !__sync_bool_compare_and_swap(&last_thread_id, last, id + 1))
+                CPU_PAUSE();
+            return id;
+        }
+    }
+
+    fprintf(stderr,
+            "Maximum number of live threads reached. Consider raising "
+            "MAX_THREADS in utils.h (current = %u)\n",
+            MAX_THREADS);
+    exit(-1);
+}
+
+// Destructor of thread_id_key: runs when a thread created with pthread_create
+// returns, calls pthread_exit or is cancelled, after its cleanup handlers and
+// thread_local destructors. The destructors of the other thread-specific data
+// keys may still take locks after it, in the same round or in the next ones,
+// and a new thread reusing the ID would share the lock contexts of this one.
+// The key is therefore set again until the last round of destructors, the
+// value counting the rounds.
+static void thread_id_release(void *arg) {
+    uintptr_t round = (uintptr_t)arg;
+
+    if (round < PTHREAD_DESTRUCTOR_ITERATIONS) {
+        pthread_setspecific(thread_id_key, (void *)(round + 1));
+        return;
+    }
+
+#if !NO_INDIRECTION
+    // Do not hold back the collection of old versions of the lock table
+    clht_gc_thread_version_max();
+#endif
+    __sync_fetch_and_and(&thread_id_map[cur_thread_id / 64],
+                         ~(1UL << (cur_thread_id % 64)));
+}
+
 volatile uint8_t init_spinlock = 0;
 
 static void __attribute__((constructor)) REAL(interpose_init)(void) {
@@ -350,21 +631,34 @@ static void __attribute__((constructor)) REAL(interpose_init)(void) {
     }
 
     printf("Using Lib%s with waiting %s\n", LOCK_ALGORITHM, WAITING_POLICY);
+#if SUPPORT_RESTRICTION && !NO_INDIRECTION
+    const char *restriction = getenv("LITL_RESTRICT");
+    if (restriction != NULL && atoi(restriction) > 0) {
+        restriction_limit = atoi(restriction);
+        printf("Restricting to %d active threads per mutex\n",
+               restriction_limit);
+    }
+#endif
 #if !NO_INDIRECTION
     pthread_to_lock = clht_create(NUM_BUCKETS);
     assert(pthread_to_lock != NULL);
 #endif
 
-    // The main thread should also have an ID
-    cur_thread_id = __sync_fetch_and_add(&last_thread_id, 1);
-    if (cur_thread_id >= MAX_THREADS) {
-        fprintf(stderr, "Maximum number of threads reached. Consider raising "
-                        "MAX_THREADS in interpose.c\n");
+    // The main thread should also have an ID (it is never released)
+    cur_thread_id = thread_id_acquire();
+    if (pthread_key_create(&thread_id_key, thread_id_release) != 0) {
+        fprintf(stderr, "Unable to create the thread ID key\n");
         exit(-1);
     }
     tinfo.tid = -1;
 #if !NO_INDIRECTION
-    clht_gc_thread_init(pthread_to_lock, cur_thread_id);
+    clht_thread_init();
+#endif
+#if PERF_COUNTERS
+    perf_thread_init();
+#endif
+#if SSPFD_PHASES
+    sspfd_thread_init();
 #endif
 
     lock_application_init();
@@ -420,7 +714,7 @@ static void __attribute__((constructor)) REAL(interpose_init)(void) {
 #if !NO_INDIRECTION
 static inline lock_context_t *get_node(lock_transparent_mutex_t *impl) {
 #if NEED_CONTEXT
-    return &impl->lock_node[cur_thread_id];
+    return lock_context_get(impl->lock_lock, impl->lock_node);
 #else
     return NULL;
 #endif
@@ -468,10 +762,15 @@ static inline void cs_log_phase(void *impl, uint8_t csphase, uint8_t phase) {
 
     if (csphase == AFTER_EXIT_CS)
         lock_level--;
+
+    perf_log_phase(impl, csphase);
+    sspfd_log_phase(csphase, phase);
 }
 #else
 #define cs_log_phase(i, c, p)                                                  \
     do {                                                                       \
+        perf_log_phase(i, c);                                                  \
+        sspfd_log_phase(c, p);                                                 \
     } while (0)
 #endif
 #endif
@@ -518,6 +817,12 @@ static void __attribute__((destructor)) REAL(interpose_exit)(void) {
     /* printf("logging: %d\n", logging_done); */
     /* logging_done += 1; */
 #endif
+#endif
+#if PERF_COUNTERS
+    perf_counters_report();
+#endif
+#if SSPFD_PHASES
+    sspfd_report();
 #endif
     lock_application_exit();
 }
@@ -536,29 +841,35 @@ static void *lp_start_routine(void *_arg) {
     void *res;
     free(r);
 
-    cur_thread_id = __sync_fetch_and_add(&last_thread_id, 1);
+    cur_thread_id = thread_id_acquire();
     tinfo.tid     = -1;
-    if (cur_thread_id >= MAX_THREADS) {
-        fprintf(stderr,
-                "Maximum number of threads reached. Consider raising "
-                "MAX_THREADS in interpose.c (current = %u)\n",
-                MAX_THREADS);
-        exit(-1);
-    }
+    // The round of destructors, see thread_id_release
+    pthread_setspecific(thread_id_key, (void *)1);
 
 #if !NO_INDIRECTION
 #if ACCOUNTING
-    tlinfo[cur_thread_id].count  = 0;
-    tlinfo[cur_thread_id].cstime = malloc(sizeof(struct cstime) * MAX_COUNT);
+    // Threads reusing an ID append to the log of the previous ones
     if (tlinfo[cur_thread_id].cstime == NULL) {
-        exit(-1);
+        tlinfo[cur_thread_id].count = 0;
+        tlinfo[cur_thread_id].cstime =
+            malloc(sizeof(struct cstime) * MAX_COUNT);
+        if (tlinfo[cur_thread_id].cstime == NULL) {
+            exit(-1);
+        }
+        memset(tlinfo[cur_thread_id].cstime, 0,
+               sizeof(struct cstime) * MAX_COUNT);
     }
-    memset(tlinfo[cur_thread_id].cstime, 0, sizeof(struct cstime) * MAX_COUNT);
 #endif
 #endif
 
 #if !NO_INDIRECTION
-    clht_gc_thread_init(pthread_to_lock, cur_thread_id);
+    clht_thread_init();
+#endif
+#if PERF_COUNTERS
+    perf_thread_init();
+#endif
+#if SSPFD_PHASES
+    sspfd_thread_init();
 #endif
     lock_thread_start();
     res = fct(arg);
@@ -640,6 +951,9 @@ int pthread_mutex_destroy(pthread_mutex_t *mutex) {
         pthread_to_lock, (clht_addr_t)mutex);
     if (impl != NULL) {
         lock_mutex_destroy(impl->lock_lock);
+#if NEED_CONTEXT
+        lock_context_free(impl->lock_node);
+#endif
         free(impl);
     }
 
@@ -656,6 +970,9 @@ int pthread_mutex_lock(pthread_mutex_t *mutex) {
 #if !NO_INDIRECTION
     lock_transparent_mutex_t *impl = ht_lock_get(mutex);
     cs_log_phase(mutex, BEFORE_ENTER_CS, PHASE_LOCK);
+#if SUPPORT_RESTRICTION
+    restriction_enter(&impl->restriction);
+#endif
     ret = lock_mutex_lock(impl->lock_lock, get_node(impl));
     cs_log_phase(mutex, AFTER_ENTER_CS, PHASE_LOCK);
 #else
@@ -664,9 +981,50 @@ int pthread_mutex_lock(pthread_mutex_t *mutex) {
     return ret;
 }
 
+// Algorithms with an abortable queue define lock_mutex_timedlock. The others
+// retry their trylock until the deadline.
+static inline int lock_timedlock(lock_mutex_t *lock, lock_context_t *me,
+                                 const struct timespec *abstime) {
+    int ret;
+
+    // An invalid date is only reported if the lock is busy
+    if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000L) {
+        ret = lock_mutex_trylock(lock, me);
+        return ret == EBUSY ? EINVAL : ret;
+    }
+
+#ifdef lock_mutex_timedlock
+    ret = lock_mutex_timedlock(lock, me, abstime);
+#else
+    while ((ret = lock_mutex_trylock(lock, me)) == EBUSY) {
+        if (timespec_passed(abstime))
+            return ETIMEDOUT;
+        CPU_PAUSE();
+    }
+#endif
+    return ret;
+}
+
 int pthread_mutex_timedlock(pthread_mutex_t *mutex,
                             const struct timespec *abstime) {
-    assert(0 && "Timed locks not supported");
+    int ret;
+
+    DEBUG_PTHREAD("[p] pthread_mutex_timedlock\n");
+#if !NO_INDIRECTION
+    lock_transparent_mutex_t *impl = ht_lock_get(mutex);
+    // Logged as a trylock, since it may not enter the critical section
+    cs_log_phase(mutex, BEFORE_ENTER_CS, PHASE_TRYLOCK);
+    ret = lock_timedlock(impl->lock_lock, get_node(impl), abstime);
+    if (ret == 0) {
+#if SUPPORT_RESTRICTION
+        restriction_taken(&impl->restriction);
+#endif
+        cs_log_phase(mutex, AFTER_ENTER_CS, PHASE_TRYLOCK);
+    }
+#else
+    ret = lock_timedlock(mutex, NULL, abstime);
+#endif
+    return ret;
 }
 
 int pthread_mutex_trylock(pthread_mutex_t *mutex) {
@@ -677,7 +1035,13 @@ int pthread_mutex_trylock(pthread_mutex_t *mutex) {
     lock_transparent_mutex_t *impl = ht_lock_get(mutex);
     cs_log_phase(mutex, BEFORE_ENTER_CS, PHASE_TRYLOCK);
     ret = lock_mutex_trylock(impl->lock_lock, get_node(impl));
-    cs_log_phase(mutex, AFTER_ENTER_CS, PHASE_TRYLOCK);
+    // A failed trylock does not enter the critical section
+    if (ret == 0) {
+#if SUPPORT_RESTRICTION
+        restriction_taken(&impl->restriction);
+#endif
+        cs_log_phase(mutex, AFTER_ENTER_CS, PHASE_TRYLOCK);
+    }
 #else
     ret = lock_mutex_trylock(mutex, NULL);
 #endif
@@ -689,6 +1053,9 @@ int pthread_mutex_unlock(pthread_mutex_t *mutex) {
 #if !NO_INDIRECTION
     lock_transparent_mutex_t *impl = ht_lock_get(mutex);
     cs_log_phase(mutex, BEFORE_EXIT_CS, PHASE_UNLOCK);
+#if SUPPORT_RESTRICTION
+    restriction_leave(&impl->restriction);
+#endif
     lock_mutex_unlock(impl->lock_lock, get_node(impl));
     cs_log_phase(mutex, AFTER_EXIT_CS, PHASE_UNLOCK);
 #else
@@ -697,6 +1064,71 @@ int pthread_mutex_unlock(pthread_mutex_t *mutex) {
     return 0;
 }
 
+// Public delegation API (see include/litl.h)
+void *litl_delegate(pthread_mutex_t *mutex, void *(*fn)(void *), void *arg) {
+    void *ret;
+
+    DEBUG_PTHREAD("[p] litl_delegate\n");
+#if !NO_INDIRECTION && defined(lock_mutex_delegate)
+    lock_transparent_mutex_t *impl = ht_lock_get(mutex);
+    ret = lock_mutex_delegate(impl->lock_lock, fn, arg);
+#else
+    // Locks without delegation run the closure like any critical section
+    pthread_mutex_lock(mutex);
+    ret = fn(arg);
+    pthread_mutex_unlock(mutex);
+#endif
+    return ret;
+}
+
+int litl_serve(pthread_mutex_t *mutex) {
+    DEBUG_PTHREAD("[p] litl_serve\n");
+#if !NO_INDIRECTION && defined(lock_mutex_serve)
+    lock_transparent_mutex_t *impl = ht_lock_get(mutex);
+    return lock_mutex_serve(impl->lock_lock);
+#else
+    return ENOTSUP;
+#endif
+}
+
+#ifdef lock_before_blocking
+int fsync(int fd) {
+    if (REAL(fsync) == NULL)
+        LOAD_FUNC(fsync, 1, FCT_LINK_SUFFIX);
+    lock_before_blocking();
+    return REAL(fsync)(fd);
+}
+
+int fdatasync(int fd) {
+    if (REAL(fdatasync) == NULL)
+        LOAD_FUNC(fdatasync, 1, FCT_LINK_SUFFIX);
+    lock_before_blocking();
+    return REAL(fdatasync)(fd);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+    if (REAL(nanosleep) == NULL)
+        LOAD_FUNC(nanosleep, 1, FCT_LINK_SUFFIX);
+    lock_before_blocking();
+    return REAL(nanosleep)(req, rem);
+}
+
+int usleep(useconds_t usec) {
+    if (REAL(usleep) == NULL)
+        LOAD_FUNC(usleep, 1, FCT_LINK_SUFFIX);
+    lock_before_blocking();
+    return REAL(usleep)(usec);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    if (REAL(poll) == NULL)
+        LOAD_FUNC(poll, 1, FCT_LINK_SUFFIX);
+    if (timeout != 0)
+        lock_before_blocking();
+    return REAL(poll)(fds, nfds, timeout);
+}
+#endif
+
 int __pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
     int ret;
     DEBUG_PTHREAD("[p] pthread_cond_init\n");
@@ -717,7 +1149,13 @@ int __pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
     int ret;
 #if !NO_INDIRECTION
     lock_transparent_mutex_t *impl = ht_lock_get(mutex);
+#if SUPPORT_RESTRICTION
+    restriction_leave(&impl->restriction);
+#endif
     ret = lock_cond_timedwait(cond, impl->lock_lock, get_node(impl), abstime);
+#if SUPPORT_RESTRICTION
+    restriction_taken(&impl->restriction);
+#endif
 #else
     ret = lock_cond_timedwait(cond, mutex, NULL, abstime);
 #endif
@@ -730,7 +1168,13 @@ int __pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
     DEBUG_PTHREAD("[p] pthread_cond_wait\n");
 #if !NO_INDIRECTION
     lock_transparent_mutex_t *impl = ht_lock_get(mutex);
+#if SUPPORT_RESTRICTION
+    restriction_leave(&impl->restriction);
+#endif
     lock_cond_wait(cond, impl->lock_lock, get_node(impl));
+#if SUPPORT_RESTRICTION
+    restriction_taken(&impl->restriction);
+#endif
 #else
     lock_cond_wait(cond, mutex, NULL);
 #endif
@@ -773,6 +1217,9 @@ int pthread_spin_destroy(pthread_spinlock_t *spin) {
         pthread_to_lock, (clht_addr_t)spin);
     if (impl != NULL) {
         lock_mutex_destroy(impl->lock_lock);
+#if NEED_CONTEXT
+        lock_context_free(impl->lock_node);
+#endif
         free(impl);
     }
 
@@ -803,7 +1250,8 @@ int pthread_spin_trylock(pthread_spinlock_t *spin) {
     lock_transparent_mutex_t *impl = ht_lock_get((void *)spin);
     cs_log_phase((void *)spin, BEFORE_ENTER_CS, PHASE_TRYLOCK);
     ret = lock_mutex_trylock(impl->lock_lock, get_node(impl));
-    cs_log_phase((void *)spin, AFTER_ENTER_CS, PHASE_TRYLOCK);
+    if (ret == 0)
+        cs_log_phase((void *)spin, AFTER_ENTER_CS, PHASE_TRYLOCK);
 #else
     assert(0 && "spinlock not supported without indirection");
 #endif
@@ -830,7 +1278,7 @@ typedef struct {
     lock_rwlock_t *lock_lock;
     char __pad[pad_to_cache_line(sizeof(lock_rwlock_t *))];
 #if NEED_CONTEXT
-    lock_context_t lock_node[MAX_THREADS];
+    lock_context_t *volatile lock_node[LOCK_CONTEXT_CHUNKS];
 #endif
 } lock_transparent_rwlock_t;
 
@@ -839,7 +1287,7 @@ ht_rwlock_create(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr) {
     lock_transparent_rwlock_t *impl = alloc_cache_align(sizeof *impl);
     impl->lock_lock                 = lock_rwlock_create(attr);
 #if NEED_CONTEXT
-    lock_init_context(impl->lock_lock, impl->lock_node, MAX_THREADS);
+    memset((void *)impl->lock_node, 0, sizeof(impl->lock_node));
 #endif
 
     // If a lock is initialized statically and two threads acquire the locks at
@@ -867,7 +1315,7 @@ static lock_transparent_rwlock_t *ht_rwlock_get(pthread_rwlock_t *rwlock) {
 
 static inline lock_context_t *get_rwlock_node(lock_transparent_rwlock_t *impl) {
 #if NEED_CONTEXT
-    return &impl->lock_node[cur_thread_id];
+    return lock_context_get(impl->lock_lock, impl->lock_node);
 #else
     return NULL;
 #endif
@@ -896,6 +1344,9 @@ int pthread_rwlock_destroy(pthread_rwlock_t *rwlock) {
         pthread_to_lock, (clht_addr_t)rwlock);
     if (impl != NULL) {
         lock_rwlock_destroy(impl->lock_lock);
+#if NEED_CONTEXT
+        lock_context_free(impl->lock_node);
+#endif
         free(impl);
     }
     return 0;
@@ -949,7 +1400,8 @@ int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock) {
     lock_transparent_rwlock_t *impl = ht_rwlock_get((void *)rwlock);
     cs_log_phase((void *)rwlock, BEFORE_ENTER_CS, PHASE_RD_TRYLOCK);
     ret = lock_rwlock_tryrdlock(impl->lock_lock, get_rwlock_node(impl));
-    cs_log_phase((void *)rwlock, AFTER_ENTER_CS, PHASE_RD_TRYLOCK);
+    if (ret == 0)
+        cs_log_phase((void *)rwlock, AFTER_ENTER_CS, PHASE_RD_TRYLOCK);
 #else
     assert(0 && "rwlock not supported without indirection");
 #endif
@@ -963,7 +1415,8 @@ int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock) {
     lock_transparent_rwlock_t *impl = ht_rwlock_get((void *)rwlock);
     cs_log_phase((void *)rwlock, BEFORE_ENTER_CS, PHASE_TRYLOCK);
     ret = lock_rwlock_trywrlock(impl->lock_lock, get_rwlock_node(impl));
-    cs_log_phase((void *)rwlock, AFTER_ENTER_CS, PHASE_TRYLOCK);
+    if (ret == 0)
+        cs_log_phase((void *)rwlock, AFTER_ENTER_CS, PHASE_TRYLOCK);
 #else
     assert(0 && "rwlock not supported without indirection");
 #endif
@@ -1007,6 +1460,9 @@ int pthread_rwlock_destroy(pthread_rwlock_t *rwlock) {
         pthread_to_lock, (clht_addr_t)rwlock);
     if (impl != NULL) {
         lock_mutex_destroy(impl->lock_lock);
+#if NEED_CONTEXT
+        lock_context_free(impl->lock_node);
+#endif
         free(impl);
     }
 #if ACCOUNTING
@@ -1080,7 +1536,8 @@ int pthread_rwlock_rdtrylock(pthread_rwlock_t *rwlock) {
     lock_transparent_mutex_t *impl = ht_lock_get((void *)rwlock);
     cs_log_phase((void *)rwlock, BEFORE_ENTER_CS, PHASE_RD_TRYLOCK);
     ret = lock_mutex_trylock(impl->lock_lock, get_node(impl));
-    cs_log_phase((void *)rwlock, AFTER_ENTER_CS, PHASE_RD_TRYLOCK);
+    if (ret == 0)
+        cs_log_phase((void *)rwlock, AFTER_ENTER_CS, PHASE_RD_TRYLOCK);
 #else
     assert(0 && "rwlock not supported without indirection");
 #endif
@@ -1094,7 +1551,8 @@ int pthread_rwlock_wrtrylock(pthread_rwlock_t *rwlock) {
     lock_transparent_mutex_t *impl = ht_lock_get((void *)rwlock);
     cs_log_phase((void *)rwlock, BEFORE_ENTER_CS, PHASE_TRYLOCK);
     ret = lock_mutex_trylock(impl->lock_lock, get_node(impl));
-    cs_log_phase((void *)rwlock, AFTER_ENTER_CS, PHASE_TRYLOCK);
+    if (ret == 0)
+        cs_log_phase((void *)rwlock, AFTER_ENTER_CS, PHASE_TRYLOCK);
 #else
     assert(0 && "rwlock not supported without indirection");
 #endif
@@ -1115,3 +1573,30 @@ int pthread_rwlock_unlock(pthread_rwlock_t *rwlock) {
 }
 
 #endif /* TTASRW rwlock implementation */
+
+// glibc 2.34 moved libpthread into libc and gave these functions a new
+// default version.  Binaries linked against it ask for name@GLIBC_2.34 and
+// would bypass a name@GLIBC_2.2.5 definition, so export both.
+#define COMPAT_VERSION(name)                                                   \
+    __asm__(".symver " #name "," #name "@GLIBC_2.2.5");                        \
+    __asm__(".symver " #name "," #name "@@GLIBC_2.34")
+
+COMPAT_VERSION(pthread_create);
+COMPAT_VERSION(pthread_mutex_timedlock);
+COMPAT_VERSION(pthread_mutex_trylock);
+COMPAT_VERSION(pthread_spin_init);
+COMPAT_VERSION(pthread_spin_destroy);
+COMPAT_VERSION(pthread_spin_lock);
+COMPAT_VERSION(pthread_spin_trylock);
+COMPAT_VERSION(pthread_spin_unlock);
+COMPAT_VERSION(pthread_rwlock_init);
+COMPAT_VERSION(pthread_rwlock_destroy);
+COMPAT_VERSION(pthread_rwlock_rdlock);
+COMPAT_VERSION(pthread_rwlock_wrlock);
+COMPAT_VERSION(pthread_rwlock_timedrdlock);
+COMPAT_VERSION(pthread_rwlock_timedwrlock);
+#if defined(TTASRW) || defined(HMCSRW)
+COMPAT_VERSION(pthread_rwlock_tryrdlock);
+COMPAT_VERSION(pthread_rwlock_trywrlock);
+#endif
+COMPAT_VERSION(pthread_rwlock_unlock);
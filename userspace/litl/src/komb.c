@@ -1,15 +1,19 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
 #include <papi.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include "interpose.h"
 #include "utils.h"
+#include "sspfd_phases.h"
 #include "waiting_policy.h"
 #include <combiner.h>
 #include <komb.h>
@@ -66,15 +70,34 @@ static unsigned long counter = 0;
                       __scalar_type_to_expr_cases(long long), default          \
                     : (x)))
 
+#if defined(WAITING_TIMESLICE)
+// While spinning threads get preempted, the waiters give their core away so
+// that the lock holder and the next combiner can run
+#define komb_spin_begin() uint64_t __last = rdtsc()
+#define komb_relax()                                                           \
+    do {                                                                       \
+        if (timeslice_oversubscribed(&__last))                                 \
+            sched_yield();                                                     \
+        else                                                                   \
+            CPU_PAUSE();                                                       \
+    } while (0)
+#else
+#define komb_spin_begin()                                                      \
+    do {                                                                       \
+    } while (0)
+#define komb_relax() CPU_PAUSE()
+#endif
+
 #define smp_cond_load_relaxed(ptr, cond_expr)                                  \
     ({                                                                         \
         typeof(ptr) __PTR = (ptr);                                             \
         __unqual_scalar_typeof(*ptr) VAL;                                      \
+        komb_spin_begin();                                                     \
         for (;;) {                                                             \
             VAL = READ_ONCE(*__PTR);                                           \
             if (cond_expr)                                                     \
                 break;                                                         \
-            CPU_PAUSE();                                                       \
+            komb_relax();                                                      \
         }                                                                      \
         (typeof(*ptr))VAL;                                                     \
     })
@@ -88,14 +111,13 @@ extern __thread unsigned int cur_thread_id;
                 __LINE__, ##__VA_ARGS__);                                      \
     } while (0);
 
-static inline int current_numa_node() {
+static inline int current_cpu() {
     unsigned long a, d, c;
-    int core;
     __asm__ volatile("rdtscp" : "=a"(a), "=d"(d), "=c"(c));
-    core = c & 0xFFF;
-    return core / (CPU_NUMBER / NUMA_NODES);
+    return c & 0xFFF;
 }
 
+
 #define false 0
 #define true 1
 
@@ -104,6 +126,25 @@ static inline int current_numa_node() {
 
 static long komb_batch_size = 262144;
 
+/*
+ * Topology-aware batching: the combiner executes the waiters closest to it
+ * first. The distance between two CPUs is the first level of the hierarchy
+ * below that they share (0 = same core, i.e., SMT siblings, up to
+ * KOMB_LEVELS = different sockets). While walking the queue, the combiner
+ * executes the waiters of its own core right away and sets the others aside,
+ * by distance. When it reaches the end of the queue, it executes the closest
+ * waiters set aside, up to komb_combine_level. The waiters that are farther
+ * are handed the lock at the end of the batch, so that one of them combines
+ * for its own domain. komb_combine_level defaults to the socket (the original
+ * NUMA-aware policy) and can be set with LITL_KOMB_COMBINE=core|llc|socket|all.
+ */
+enum { KOMB_LEVEL_CORE, KOMB_LEVEL_LLC, KOMB_LEVEL_SOCKET, KOMB_LEVELS };
+
+// Identifier (lowest CPU number) of the domain of each CPU at each level
+static int (*komb_topology)[KOMB_LEVELS];
+static int komb_ncpus;
+static int komb_combine_level = KOMB_LEVEL_SOCKET;
+
 static inline void smp_wmb(void) {
     __asm __volatile("sfence" ::: "memory");
 }
@@ -112,8 +153,13 @@ static inline void smp_mb(void) {
     __asm __volatile("mfence" ::: "memory");
 }
 
-_Thread_local komb_node_t *volatile local_queue_head;
-_Thread_local komb_node_t *volatile local_queue_tail;
+// Waiters set aside by the combiner, by distance (index 0 is unused)
+_Thread_local komb_node_t *volatile local_queue_head[KOMB_LEVELS + 1];
+_Thread_local komb_node_t *volatile local_queue_tail[KOMB_LEVELS + 1];
+// First waiter of the queue the combiner has not walked yet
+_Thread_local komb_node_t *volatile komb_queue_node;
+// Where komb_next_node comes from: -1 for the queue, else its distance
+_Thread_local int komb_next_level;
 _Thread_local volatile komb_node_t my_local_node;
 _Thread_local komb_mutex_t *volatile lock_addr[8];
 
@@ -125,6 +171,13 @@ _Thread_local komb_node_t *volatile komb_prev_node;
 _Thread_local komb_node_t *volatile komb_curr_node;
 _Thread_local komb_node_t *volatile komb_next_node;
 _Thread_local volatile long counter_val;
+// Set on the server thread (see komb_mutex_serve)
+_Thread_local int komb_is_server;
+// Sentinel ending the batch of the server, NULL for a combiner
+_Thread_local komb_node_t *volatile komb_batch_end;
+// Waiter sent back to its thread by komb_before_blocking
+_Thread_local komb_node_t *volatile komb_blocked_node;
+_Thread_local int komb_in_closure;
 
 /*
  * incoming_rsp_ptr -> rdi
@@ -180,50 +233,257 @@ static __always_inline void check_and_set_combiner(komb_mutex_t *lock) {
     }
 }
 
-__always_inline static void add_to_local_queue(komb_node_t *node) {
+static int komb_read_domain(int cpu, const char *file) {
+    char path[128];
+    FILE *f;
+    int id;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu,
+             file);
+    f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    // CPU lists start with their lowest CPU
+    if (fscanf(f, "%d", &id) != 1)
+        id = -1;
+    fclose(f);
+    return id;
+}
+
+static void komb_topology_init(void) {
+    const char *combine = getenv("LITL_KOMB_COMBINE");
+    int cpu, id;
+
+    komb_ncpus    = sysconf(_SC_NPROCESSORS_CONF);
+    komb_topology = malloc(komb_ncpus * sizeof(*komb_topology));
+    if (komb_topology == NULL) {
+        fprintf(stderr, "Unable to allocate the komb topology\n");
+        exit(-1);
+    }
+
+    // Fall back to the CPU / NUMA node split of topology.h
+    for (cpu = 0; cpu < komb_ncpus; cpu++) {
+        komb_topology[cpu][KOMB_LEVEL_SOCKET] =
+            cpu / (CPU_NUMBER / NUMA_NODES);
+        if ((id = komb_read_domain(cpu, "topology/package_cpus_list")) >= 0 ||
+            (id = komb_read_domain(cpu, "topology/core_siblings_list")) >= 0)
+            komb_topology[cpu][KOMB_LEVEL_SOCKET] = id;
+
+        komb_topology[cpu][KOMB_LEVEL_LLC] =
+            komb_topology[cpu][KOMB_LEVEL_SOCKET];
+        if ((id = komb_read_domain(cpu, "cache/index3/shared_cpu_list")) >= 0)
+            komb_topology[cpu][KOMB_LEVEL_LLC] = id;
+
+        komb_topology[cpu][KOMB_LEVEL_CORE] = cpu;
+        if ((id = komb_read_domain(cpu, "topology/thread_siblings_list")) >= 0)
+            komb_topology[cpu][KOMB_LEVEL_CORE] = id;
+    }
+
+    if (combine == NULL || *combine == '\0')
+        return;
+    if (strcmp(combine, "core") == 0)
+        komb_combine_level = KOMB_LEVEL_CORE;
+    else if (strcmp(combine, "llc") == 0)
+        komb_combine_level = KOMB_LEVEL_LLC;
+    else if (strcmp(combine, "socket") == 0)
+        komb_combine_level = KOMB_LEVEL_SOCKET;
+    else if (strcmp(combine, "all") == 0)
+        komb_combine_level = KOMB_LEVELS;
+    else
+        fprintf(stderr, "Unknown LITL_KOMB_COMBINE=%s, using socket\n",
+                combine);
+}
+
+static inline int komb_distance(int a, int b) {
+    int level;
 
-    if (local_queue_head == NULL) {
-        local_queue_head = node;
-        local_queue_tail = node;
+    if (a >= komb_ncpus || b >= komb_ncpus)
+        return KOMB_LEVELS;
+    for (level = 0; level < KOMB_LEVELS; level++)
+        if (komb_topology[a][level] == komb_topology[b][level])
+            return level;
+    return KOMB_LEVELS;
+}
+
+__always_inline static void add_to_local_queue(komb_node_t *node, int level) {
+
+    if (local_queue_head[level] == NULL) {
+        local_queue_head[level] = node;
+        local_queue_tail[level] = node;
     } else {
-        local_queue_tail->next = node;
-        local_queue_tail       = node;
+        local_queue_tail[level]->next = node;
+        local_queue_tail[level]       = node;
     }
 }
 
-__always_inline static komb_node_t *get_next_node(komb_node_t *my_node) {
-    komb_node_t *curr_node, *next_node;
+__always_inline static void prefetch_node(komb_node_t *next_node) {
+    void *rsp_ptr = next_node->rsp;
 
-    curr_node = my_node;
-    next_node = curr_node->next;
+    // A closure runs on the stack of the combiner, but likely touches its
+    // argument
+    if (next_node->fn != NULL) {
+        PREFETCHW((next_node->arg));
+        return;
+    }
+    PREFETCHW((rsp_ptr));
+    PREFETCHW((rsp_ptr + 64));
+    PREFETCHW((rsp_ptr + 128));
+    PREFETCHW((rsp_ptr + 192));
+    PREFETCHW((rsp_ptr + 256));
+    PREFETCHW((rsp_ptr + 320));
+}
 
-    while (true) {
-        if (next_node == NULL || next_node->next == NULL)
-            goto next_node_null;
-
-        if (next_node->socket_id == current_numa_node()) {
-            void *rsp_ptr = next_node->rsp;
-            PREFETCHW((rsp_ptr));
-            PREFETCHW((rsp_ptr + 64));
-            PREFETCHW((rsp_ptr + 128));
-            PREFETCHW((rsp_ptr + 192));
-            PREFETCHW((rsp_ptr + 256));
-            PREFETCHW((rsp_ptr + 320));
+/*
+ * Working-set prefetching: the data protected by a lock is often next to the
+ * application mutex (in the same object), and its lines were last written by
+ * the previous combiner. komb_mutex_attach records a window of
+ * KOMB_WINDOW_LINES lines around the mutex. One batch out of
+ * KOMB_PREFETCH_SAMPLE, starting with the first one, compares a checksum of
+ * each line before and after the batch to learn the lines written by the
+ * critical sections; the other batches prefetch the lines written in the last
+ * two samples before running the first waiter. Disabled with
+ * LITL_KOMB_PREFETCH=0.
+ */
+#define KOMB_LINE_SIZE 64
+#define KOMB_WINDOW_BEFORE 4
+#define KOMB_WINDOW_LINES 16
+#define KOMB_PREFETCH_SAMPLE 64
 
-            PREFETCH((next_node->next));
+static int komb_prefetch = 1;
+
+static inline uint64_t komb_line_sum(const char *line) {
+    const volatile uint64_t *words = (const volatile uint64_t *)line;
+    uint64_t sum = 0;
+    unsigned int i;
+
+    for (i = 0; i < KOMB_LINE_SIZE / sizeof(uint64_t); i++)
+        sum = ((sum << 7) | (sum >> 57)) ^ words[i];
+    return sum;
+}
 
+// Called by the combiner before running the batch. Returns whether this batch
+// is sampled, in which case the checksums are stored in sums.
+static __always_inline int komb_prefetch_begin(komb_mutex_t *lock,
+                                               uint64_t *sums) {
+    int i;
+
+    if (lock->window == NULL)
+        return false;
+
+    if (lock->batches++ % KOMB_PREFETCH_SAMPLE != 0) {
+        for (i = 0; i < KOMB_WINDOW_LINES; i++)
+            if (lock->hot_lines & (1U << i))
+                PREFETCHW((lock->window + i * KOMB_LINE_SIZE));
+        return false;
+    }
+
+    for (i = 0; i < KOMB_WINDOW_LINES; i++)
+        if (lock->window_lines & (1U << i))
+            sums[i] = komb_line_sum(lock->window + i * KOMB_LINE_SIZE);
+    return true;
+}
+
+static void komb_prefetch_learn(komb_mutex_t *lock, uint64_t *sums) {
+    uint16_t written = 0;
+    int i;
+
+    for (i = 0; i < KOMB_WINDOW_LINES; i++)
+        if ((lock->window_lines & (1U << i)) &&
+            komb_line_sum(lock->window + i * KOMB_LINE_SIZE) != sums[i])
+            written |= 1U << i;
+
+    lock->hot_lines    = written | lock->last_written;
+    lock->last_written = written;
+}
+
+// Called once my_node has been executed, returns the next waiter to execute.
+// The last waiter of the queue is never executed (it becomes the next
+// combiner), so returning it or NULL ends the batch.
+__always_inline static komb_node_t *get_next_node(komb_node_t *my_node) {
+    komb_node_t *next_node;
+    int cpu;
+    int level;
+
+    // The server runs all the waiters up to komb_batch_end, in order. The
+    // successor of my_node may not have linked itself to it yet.
+    if (komb_batch_end != NULL) {
+        next_node       = smp_cond_load_relaxed(&my_node->next, (VAL));
+        komb_queue_node = next_node;
+        if (next_node != komb_batch_end)
+            prefetch_node(next_node);
+        return next_node;
+    }
+
+    // Remove my_node from where it was taken
+    if (komb_next_level < 0) {
+        komb_queue_node = my_node->next;
+    } else {
+        BUG_ON(local_queue_head[komb_next_level] != my_node);
+        if (my_node == local_queue_tail[komb_next_level])
+            local_queue_head[komb_next_level] =
+                local_queue_tail[komb_next_level] = NULL;
+        else
+            local_queue_head[komb_next_level] = my_node->next;
+    }
+
+    cpu       = current_cpu();
+    next_node = komb_queue_node;
+    while (next_node != NULL && next_node->next != NULL) {
+        level = komb_distance(cpu, next_node->hw_cpu);
+        if (level == KOMB_LEVEL_CORE) {
+            prefetch_node(next_node);
+            PREFETCH((next_node->next));
+            komb_next_level = -1;
             return next_node;
         }
 
-        add_to_local_queue(next_node);
-        curr_node = next_node;
-        next_node = curr_node->next;
+        add_to_local_queue(next_node, level);
+        next_node       = next_node->next;
+        komb_queue_node = next_node;
     }
 
-next_node_null:
+    // End of the queue: continue with the closest waiters set aside
+    for (level = KOMB_LEVEL_CORE + 1; level <= komb_combine_level; level++) {
+        if (local_queue_head[level] != NULL) {
+            prefetch_node(local_queue_head[level]);
+            komb_next_level = level;
+            return local_queue_head[level];
+        }
+    }
+
+    komb_next_level = -1;
     return next_node;
 }
 
+// Whether the combiner runs node in the current batch: the last waiter of the
+// queue is never run, it becomes the next combiner. The server runs every
+// waiter before its sentinel.
+static __always_inline int in_batch(komb_node_t *node) {
+    if (komb_batch_end != NULL)
+        return node != NULL && node != komb_batch_end;
+    return node != NULL && node->next != NULL && counter_val < komb_batch_size;
+}
+
+// Runs the delegated critical sections (see komb_mutex_delegate) from node on,
+// directly on the current stack. Returns the first waiter that is not one.
+static __always_inline komb_node_t *run_closures(komb_node_t *node) {
+    komb_node_t *next_node;
+
+    while (node->fn != NULL && in_batch(node)) {
+        komb_in_closure = true;
+        node->ret       = node->fn(node->arg);
+        komb_in_closure = false;
+        counter_val += 1;
+        // The waiter may reuse its node as soon as it is completed
+        next_node = get_next_node(node);
+        clear_locked_set_completed(node);
+        node = next_node;
+        if (node == NULL)
+            break;
+    }
+    return node;
+}
+
 __attribute__((noipa, noinline)) static void
 execute_cs(komb_mutex_t *lock, komb_node_t *curr_node) {
     void *incoming_rsp_ptr, *outgoing_rsp_ptr;
@@ -250,24 +510,38 @@ execute_cs(komb_mutex_t *lock, komb_node_t *curr_node) {
     // BUG_ON(ptr->ptr - (ptr->local_shadow_stack_ptr) > SIZE_OF_SHADOW_STACK);
 }
 
-__attribute__((noipa, noinline)) static void
+// Returns whether the lock was left to a waiter that blocked (see
+// komb_before_blocking), in which case the combiner has to wait again
+__attribute__((noipa, noinline)) static int
 run_combiner(komb_mutex_t *lock, komb_node_t *curr_node) {
     BUG_ON(curr_node == NULL);
     komb_node_t *next_node = curr_node->next;
+    uint64_t sums[KOMB_WINDOW_LINES];
+    int level, learn;
 
     if (next_node == NULL) {
         set_locked(lock);
         curr_node->locked = false;
         smp_mb();
-        return;
+        return false;
     }
 
-    counter_val = 0;
-
-    dprintf("Combiner %d giving control to %d\n", cur_thread_id,
-            curr_node->cpuid);
+    counter_val     = 0;
+    komb_queue_node = curr_node;
+    komb_next_level = -1;
+    learn           = komb_prefetch_begin(lock, sums);
+
+    sspfd_phase_begin(SSPFD_COMBINE);
+    curr_node = run_closures(curr_node);
+    if (in_batch(curr_node)) {
+        dprintf("Combiner %d giving control to %d\n", cur_thread_id,
+                curr_node->cpuid);
+        execute_cs(lock, curr_node);
+    }
+    sspfd_phase_end(SSPFD_COMBINE);
 
-    execute_cs(lock, curr_node);
+    if (learn)
+        komb_prefetch_learn(lock, sums);
 
     dprintf("Combiner got the control back: %d counter: %ld last_waiter: %d\n",
             cur_thread_id, counter_val, komb_curr_node->cpuid);
@@ -277,13 +551,17 @@ run_combiner(komb_mutex_t *lock, komb_node_t *curr_node) {
         komb_prev_node = NULL;
     }
 
-    next_node = komb_next_node;
+    // Put the waiters set aside back in front of the rest of the queue, the
+    // closest first: the first of them becomes the next combiner
+    next_node = komb_queue_node;
 
-    if (local_queue_head != NULL) {
-        local_queue_tail->next = next_node;
-        next_node              = local_queue_head;
-        local_queue_head       = NULL;
-        local_queue_tail       = NULL;
+    for (level = KOMB_LEVELS; level > KOMB_LEVEL_CORE; level--) {
+        if (local_queue_head[level] != NULL) {
+            local_queue_tail[level]->next = next_node;
+            next_node                     = local_queue_head[level];
+            local_queue_head[level]       = NULL;
+            local_queue_tail[level]       = NULL;
+        }
     }
 
     BUG_ON(next_node == NULL);
@@ -292,21 +570,36 @@ run_combiner(komb_mutex_t *lock, komb_node_t *curr_node) {
             next_node->cpuid);
 
     set_locked(lock);
-    komb_curr_node    = NULL;
+    komb_curr_node = NULL;
+
+    // The waiter resumes its critical section on its own thread, and releases
+    // the lock like an uncontended holder: next_node waits for it
+    curr_node         = komb_blocked_node;
+    komb_blocked_node = NULL;
+    if (curr_node != NULL)
+        clear_locked_set_completed(curr_node);
+
     next_node->locked = false;
+    return curr_node != NULL;
 }
 
 __attribute__((noipa, noinline)) static int
 __komb_spin_lock_longjmp(komb_mutex_t *lock, komb_node_t *curr_node) {
     register komb_node_t *prev_node = NULL, *next_node = NULL;
+    int handed_off;
 
+retry:
+    sspfd_phase_begin(SSPFD_JOIN);
     prev_node = smp_swap(&lock->tail, curr_node);
 
     if (prev_node) {
 
         WRITE_ONCE(prev_node->next, curr_node);
+        sspfd_phase_end(SSPFD_JOIN);
 
+        sspfd_phase_begin(SSPFD_WAIT);
         smp_cond_load_relaxed(&curr_node->locked, !(VAL));
+        sspfd_phase_end(SSPFD_WAIT);
 
         if (curr_node->completed) {
             int j = 7;
@@ -319,6 +612,8 @@ __komb_spin_lock_longjmp(komb_mutex_t *lock, komb_node_t *curr_node) {
             BUG_ON(lock_addr[j] == lock);
             return 0;
         }
+    } else {
+        sspfd_phase_end(SSPFD_JOIN);
     }
 
     check_and_set_combiner(lock);
@@ -337,13 +632,14 @@ __komb_spin_lock_longjmp(komb_mutex_t *lock, komb_node_t *curr_node) {
     komb_prev_node   = NULL;
     komb_next_node   = NULL;
     counter_val      = 0;
-    local_queue_head = NULL;
-    local_queue_tail = NULL;
+
+    int j;
+    for (j = 0; j <= KOMB_LEVELS; j++)
+        local_queue_head[j] = local_queue_tail[j] = NULL;
 
     curr_node->count--;
     lock->locked = _Q_LOCKED_COMBINER_VAL;
 
-    int j;
     for (j = 7; j >= 0; j--)
         if (lock_addr[j] != NULL)
             break;
@@ -354,12 +650,19 @@ __komb_spin_lock_longjmp(komb_mutex_t *lock, komb_node_t *curr_node) {
     else
         lock_addr[j] = lock;
 
-    run_combiner(lock, next_node);
+    handed_off = run_combiner(lock, next_node);
 
     BUG_ON(lock_addr[j] != lock);
 
     lock_addr[j] = NULL;
 
+    if (handed_off) {
+        curr_node->locked    = true;
+        curr_node->completed = false;
+        curr_node->next      = NULL;
+        goto retry;
+    }
+
     return 0;
 
 release:
@@ -382,9 +685,11 @@ __komb_spin_lock_slowpath(komb_mutex_t *lock) {
     curr_node->locked    = true;
     curr_node->completed = false;
     curr_node->next      = NULL;
-    curr_node->socket_id = current_numa_node();
+    curr_node->hw_cpu    = current_cpu();
+    curr_node->socket_id = curr_node->hw_cpu / (CPU_NUMBER / NUMA_NODES);
     curr_node->cpuid     = cur_thread_id;
     curr_node->lock      = lock;
+    curr_node->fn        = NULL;
 
     return __komb_spin_lock_longjmp(lock, curr_node);
 }
@@ -458,7 +763,13 @@ komb_mutex_t *komb_mutex_create(const pthread_mutexattr_t *attr) {
     komb_mutex_t *impl =
         (komb_mutex_t *)alloc_cache_align(sizeof(komb_mutex_t));
     impl->tail   = NULL;
-    impl->locked = 0;
+    impl->locked       = 0;
+    impl->served       = 0;
+    impl->window       = NULL;
+    impl->window_lines = 0;
+    impl->hot_lines    = 0;
+    impl->last_written = 0;
+    impl->batches      = 0;
 #if COND_VAR
     REAL(pthread_mutex_init)(&impl->posix_lock, attr);
     DEBUG("Mutex init lock=%p posix_lock=%p\n", impl, &impl->posix_lock);
@@ -468,12 +779,41 @@ komb_mutex_t *komb_mutex_create(const pthread_mutexattr_t *attr) {
     return impl;
 }
 
+// Records the window of lines around the application mutex that the combiner
+// may prefetch, without crossing the page of the mutex
+void komb_mutex_attach(komb_mutex_t *impl, void *mutex) {
+    uintptr_t line = (uintptr_t)mutex & ~(uintptr_t)(KOMB_LINE_SIZE - 1);
+    uintptr_t page = (uintptr_t)mutex & ~(uintptr_t)(PAGE_SIZE - 1);
+    uintptr_t start;
+    int i;
+
+    if (!komb_prefetch)
+        return;
+
+    start = line - page >= KOMB_WINDOW_BEFORE * KOMB_LINE_SIZE
+                ? line - KOMB_WINDOW_BEFORE * KOMB_LINE_SIZE
+                : page;
+    for (i = 0; i < KOMB_WINDOW_LINES; i++)
+        if (start + (i + 1) * KOMB_LINE_SIZE <= page + PAGE_SIZE)
+            impl->window_lines |= 1U << i;
+    impl->window = (char *)start;
+}
+
 static int __komb_mutex_lock(komb_mutex_t *lock, komb_node_t *me) {
 
+    // Nested in a critical section run by the server, which already runs all
+    // the critical sections of this lock
+    if (komb_is_server && lock->served)
+        goto release;
+
     if (smp_cas(&lock->locked, 0, _Q_LOCKED_VAL) == 0) {
         goto release;
     }
 
+    // Nested in a critical section run by the combiner: do not make the batch
+    // wait for this lock
+    komb_before_blocking();
+
     komb_spin_lock_slowpath(lock);
 
     if (komb_curr_node != NULL) {
@@ -508,7 +848,22 @@ int komb_mutex_lock(komb_mutex_t *impl, komb_node_t *UNUSED(me)) {
     return ret;
 }
 
+static int komb_served_idle(komb_mutex_t *impl);
+
 int komb_mutex_trylock(komb_mutex_t *impl, komb_node_t *UNUSED(me)) {
+    // A served lock is never free. Hand the critical section to the server
+    // only if it runs it right away, so that trylock (and the timed lock that
+    // retries it) does not wait behind other requests.
+    if (impl->served) {
+        if (komb_is_server || komb_served_idle(impl))
+            return komb_mutex_lock(impl, NULL);
+        return EBUSY;
+    }
+
+    // Fail without an atomic instruction while the lock is busy, as
+    // pthread_mutex_timedlock spins on trylock
+    if (READ_ONCE(impl->locked))
+        return EBUSY;
 
     if ((smp_cas(&impl->locked, 0, _Q_LOCKED_VAL) == 0)) {
 #if COND_VAR
@@ -544,6 +899,8 @@ __attribute__((noipa, noinline)) void __komb_mutex_unlock(komb_mutex_t *lock) {
     }
 
     if (my_idx == -1) {
+        if (komb_is_server && lock->served)
+            return;
         if (lock->locked == _Q_LOCKED_VAL)
             lock->locked = false;
         else
@@ -556,8 +913,10 @@ __attribute__((noipa, noinline)) void __komb_mutex_unlock(komb_mutex_t *lock) {
 
     BUG_ON(my_idx != max_idx);
 
-    if (komb_next_node == NULL || komb_next_node->next == NULL ||
-        counter_val >= komb_batch_size) {
+    if (komb_next_node != NULL)
+        komb_next_node = run_closures(komb_next_node);
+
+    if (!in_batch(komb_next_node)) {
         incoming_rsp_ptr = (void *)&(local_shadow_stack_ptr);
         komb_prev_node   = komb_curr_node;
         komb_curr_node   = NULL;
@@ -575,6 +934,259 @@ __attribute__((noipa, noinline)) void __komb_mutex_unlock(komb_mutex_t *lock) {
     return;
 }
 
+/*
+ * Called before a call that may block (see interpose.c). When the combiner is
+ * running the critical section of a waiter, the rest of the batch would wait
+ * behind the call: the waiter resumes its critical section on its own thread
+ * instead, keeping the lock, and the combiner gives the rest of its queue to
+ * the next combiner, which takes the lock once the waiter releases it.
+ * Closures, nested batches and the server are not handed off.
+ */
+void komb_before_blocking(void) {
+    komb_node_t *node = komb_curr_node;
+
+    if (node == NULL || komb_in_closure || komb_batch_end != NULL ||
+        lock_addr[0] == NULL || lock_addr[1] != NULL)
+        return;
+
+    dprintf("Handing off the batch before %d blocks\n", node->cpuid);
+    komb_blocked_node = node;
+    komb_curr_node    = NULL;
+    komb_context_switch((void *)&local_shadow_stack_ptr, &node->rsp);
+    // Back on the thread of the waiter
+}
+
+/*
+ * Runs fn(arg) with the lock held and returns its result.  Under contention,
+ * the closure is queued like any waiter and the combiner calls it directly,
+ * without the stack switches of the transparent path.  If this thread ends up
+ * as the combiner, it runs the batch, then fn itself.
+ * fn must not wait on a condition variable with this lock, as the Pthread lock
+ * used for condition variables is not taken.
+ */
+void *komb_mutex_delegate(komb_mutex_t *impl, void *(*fn)(void *), void *arg) {
+    komb_node_t node;
+    void *shadow_stack, *ret;
+
+    if (komb_is_server && impl->served)
+        return fn(arg);
+
+    if (smp_cas(&impl->locked, 0, _Q_LOCKED_VAL) == 0)
+        goto run;
+
+    komb_before_blocking();
+
+    node.locked    = true;
+    node.completed = false;
+    node.next      = NULL;
+    node.count     = 0;
+    node.hw_cpu    = current_cpu();
+    node.socket_id = node.hw_cpu / (CPU_NUMBER / NUMA_NODES);
+    node.cpuid     = cur_thread_id;
+    node.lock      = impl;
+    node.rsp       = NULL;
+    node.fn        = fn;
+    node.arg       = arg;
+
+    // The combiner path saves the current stack pointer in
+    // local_shadow_stack_ptr, which is only meant to point into the shadow
+    // stack (or into the batch of an outer combiner)
+    shadow_stack = local_shadow_stack_ptr;
+    __komb_spin_lock_longjmp(impl, &node);
+    local_shadow_stack_ptr = shadow_stack;
+
+    if (node.completed)
+        return node.ret;
+
+run:
+    ret = fn(arg);
+    __komb_mutex_unlock(impl);
+    return ret;
+}
+
+/*
+ * Server mode (as in RCL): the critical sections of the locks passed to
+ * komb_mutex_serve are all run by a server thread pinned on one CPU
+ * (LITL_KOMB_SERVER_CPU, the last one by default), so that the data they
+ * protect stays in the caches of this CPU instead of following the combiner.
+ * The server holds these locks for good and keeps one of its two sentinel
+ * nodes at the head of their queue, so that a waiter never becomes the
+ * combiner. To serve a lock, the server appends its other sentinel to the
+ * queue and runs every waiter in between, by switching to its stack or calling
+ * its closure like a combiner; the appended sentinel becomes the new head.
+ */
+#define KOMB_SERVER_LOCKS 16
+#define KOMB_SERVER_IDLE_SPINS 1024
+
+typedef struct komb_served {
+    komb_mutex_t *volatile lock; // NULL for a free slot
+    komb_node_t *head;
+    struct komb_node sentinels[2];
+} komb_served_t;
+
+static komb_served_t komb_served[KOMB_SERVER_LOCKS];
+static volatile int komb_served_count;
+static volatile unsigned long komb_server_rounds;
+static volatile int komb_server_busy; // Running a batch
+static int komb_server_started;
+static pthread_mutex_t komb_server_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void komb_serve_batch(komb_served_t *served) {
+    komb_mutex_t *lock = served->lock;
+    komb_node_t *head  = served->head, *end, *prev_node, *curr_node;
+
+    end = head == &served->sentinels[0] ? &served->sentinels[1]
+                                        : &served->sentinels[0];
+    end->next = NULL;
+    prev_node = smp_swap(&lock->tail, end);
+    WRITE_ONCE(prev_node->next, end);
+
+    counter_val     = 0;
+    komb_batch_end  = end;
+    komb_next_level = -1;
+    komb_queue_node = head->next;
+    lock_addr[0]    = lock;
+
+    sspfd_phase_begin(SSPFD_COMBINE);
+    curr_node = run_closures(komb_queue_node);
+    if (in_batch(curr_node))
+        execute_cs(lock, curr_node);
+    sspfd_phase_end(SSPFD_COMBINE);
+
+    if (komb_prev_node != NULL) {
+        clear_locked_set_completed(komb_prev_node);
+        komb_prev_node = NULL;
+    }
+
+    komb_curr_node = NULL;
+    komb_batch_end = NULL;
+    lock_addr[0]   = NULL;
+    served->head   = end;
+}
+
+static void *komb_server(void *UNUSED(arg)) {
+    const char *env = getenv("LITL_KOMB_SERVER_CPU");
+    int cpu         = env != NULL ? atoi(env) : komb_ncpus - 1;
+    unsigned int idle = 0;
+    cpu_set_t cpus;
+    int i, busy;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        fprintf(stderr, "Unable to pin the komb server on CPU %d\n", cpu);
+    komb_is_server = 1;
+
+    for (;;) {
+        busy = 0;
+        for (i = 0; i < komb_served_count; i++) {
+            if (komb_served[i].lock != NULL &&
+                READ_ONCE(komb_served[i].head->next) != NULL) {
+                komb_server_busy = 1;
+                komb_serve_batch(&komb_served[i]);
+                komb_server_busy = 0;
+                busy = 1;
+            }
+        }
+        komb_server_rounds++;
+
+        if (busy)
+            idle = 0;
+        else if (++idle % KOMB_SERVER_IDLE_SPINS == 0)
+            sched_yield();
+        else
+            CPU_PAUSE();
+    }
+    return NULL;
+}
+
+// Whether nobody waits for the served lock, nor runs its critical section,
+// and the server is not busy with another lock. The tail of the queue of an
+// idle served lock is the sentinel at its head.
+static int komb_served_idle(komb_mutex_t *impl) {
+    int i;
+
+    if (komb_server_busy)
+        return 0;
+
+    for (i = 0; i < komb_served_count; i++)
+        if (komb_served[i].lock == impl)
+            return READ_ONCE(impl->tail) == READ_ONCE(komb_served[i].head);
+    return 0;
+}
+
+/*
+ * Hands all the critical sections of the lock to the server thread, which is
+ * started by the first call. The lock must not be held by the caller.
+ * Returns ENOSPC when KOMB_SERVER_LOCKS locks are already served.
+ */
+int komb_mutex_serve(komb_mutex_t *impl) {
+    komb_served_t *served;
+    pthread_t server;
+    int i, ret = 0;
+
+    REAL(pthread_mutex_lock)(&komb_server_mutex);
+    if (impl->served)
+        goto out;
+
+    for (i = 0; i < komb_served_count; i++)
+        if (komb_served[i].lock == NULL)
+            break;
+    if (i == KOMB_SERVER_LOCKS) {
+        ret = ENOSPC;
+        goto out;
+    }
+
+    if (!komb_server_started) {
+        if ((ret = pthread_create(&server, NULL, komb_server, NULL)) != 0)
+            goto out;
+        pthread_detach(server);
+        komb_server_started = 1;
+    }
+
+    served = &komb_served[i];
+    memset(served->sentinels, 0, sizeof(served->sentinels));
+    served->sentinels[0].lock = served->sentinels[1].lock = impl;
+    served->head = &served->sentinels[0];
+
+    // Take the lock while nobody waits for it, the sentinel then stays at the
+    // head of its queue
+    for (;;) {
+        if (smp_cas(&impl->locked, 0, _Q_LOCKED_COMBINER_VAL) == 0) {
+            if (smp_cas(&impl->tail, NULL, served->head) == NULL)
+                break;
+            WRITE_ONCE(impl->locked, 0);
+        }
+        sched_yield();
+    }
+
+    impl->served = 1;
+    smp_mb();
+    served->lock = impl;
+    if (i == komb_served_count)
+        komb_served_count++;
+
+out:
+    REAL(pthread_mutex_unlock)(&komb_server_mutex);
+    return ret;
+}
+
+static void komb_server_detach(komb_mutex_t *impl) {
+    unsigned long rounds;
+    int i;
+
+    REAL(pthread_mutex_lock)(&komb_server_mutex);
+    for (i = 0; i < komb_served_count; i++)
+        if (komb_served[i].lock == impl)
+            komb_served[i].lock = NULL;
+    REAL(pthread_mutex_unlock)(&komb_server_mutex);
+
+    // Wait for the server to be done with the lock
+    rounds = komb_server_rounds;
+    while (!komb_is_server && komb_server_rounds - rounds < 2)
+        CPU_PAUSE();
+}
+
 void komb_mutex_unlock(komb_mutex_t *impl, komb_node_t *UNUSED(me)) {
 #if COND_VAR
     DEBUG_PTHREAD("[%d] Unlock posix=%p\n", cur_thread_id, &impl->posix_lock);
@@ -584,6 +1196,8 @@ void komb_mutex_unlock(komb_mutex_t *impl, komb_node_t *UNUSED(me)) {
 }
 
 int komb_mutex_destroy(komb_mutex_t *lock) {
+    if (lock->served)
+        komb_server_detach(lock);
 #if COND_VAR
     REAL(pthread_mutex_destroy)(&lock->posix_lock);
 #endif
@@ -672,8 +1286,13 @@ int komb_cond_destroy(komb_cond_t *cond) {
 }
 
 void komb_thread_start(void) {
-    local_queue_head = NULL;
-    local_queue_tail = NULL;
+    for (int i = 0; i <= KOMB_LEVELS; i++)
+        local_queue_head[i] = local_queue_tail[i] = NULL;
+    komb_queue_node   = NULL;
+    komb_next_level   = -1;
+    komb_batch_end    = NULL;
+    komb_blocked_node = NULL;
+    komb_in_closure   = false;
     for (int i = 0; i < 8; i++)
         lock_addr[i] = NULL;
 
@@ -689,6 +1308,11 @@ void komb_thread_exit(void) {
 }
 
 void komb_application_init(void) {
+    const char *prefetch = getenv("LITL_KOMB_PREFETCH");
+
+    if (prefetch != NULL && strcmp(prefetch, "0") == 0)
+        komb_prefetch = 0;
+    komb_topology_init();
 }
 
 void komb_application_exit(void) {
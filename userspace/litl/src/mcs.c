@@ -46,6 +46,15 @@
  * Otherwise, the thread spins on a memory address contained in its context.
  * - On unlock: if there is any thread, we just wake the next thread on the
  * waiting list. Otherwise we set the tail of the queue to NULL.
+ *
+ * Timed waiters (pthread_mutex_timedlock) can leave the queue, following the
+ * MCS lock with timeout of Scott and Scherer (PODC 2001), in a simpler form.
+ * A waiter that times out marks its node as abandoned and leaves it in the
+ * queue. The lock holder skips the abandoned nodes when it passes the lock,
+ * and gives them back to their owner once it has read their successor. A
+ * thread that comes back to the lock while its node is still abandoned in the
+ * queue takes it back and waits at its former place. The grant and the abort
+ * race on the state of the node, which is changed with a compare-and-swap.
  */
 #include <stdlib.h>
 #include <stdint.h>
@@ -60,6 +69,7 @@
 #include "waiting_policy.h"
 #include "interpose.h"
 #include "utils.h"
+#include "sspfd_phases.h"
 
 extern __thread unsigned int cur_thread_id;
 
@@ -74,20 +84,35 @@ mcs_mutex_t *mcs_mutex_create(const pthread_mutexattr_t *attr) {
     return impl;
 }
 
-static int __mcs_mutex_lock(mcs_mutex_t *impl, mcs_node_t *me) {
-    mcs_node_t *tail;
+// Returns 1 if me was abandoned in the queue by a timed waiter and is waiting
+// again, 0 if it can be enqueued
+static inline int mcs_reclaim(mcs_node_t *me) {
+    if (me->state == MCS_ABANDONED &&
+        __sync_bool_compare_and_swap(&me->state, MCS_ABANDONED, MCS_WAITING))
+        return 1;
 
-    assert(me != NULL);
+    // The lock holder is skipping it
+    while (me->state == MCS_SKIPPED)
+        CPU_PAUSE();
+    return 0;
+}
+
+// Returns 1 if me has to wait for its predecessor, 0 if it has the lock
+static inline int mcs_enqueue(mcs_mutex_t *impl, mcs_node_t *me) {
+    mcs_node_t *tail;
 
-    me->next = LOCKED;
-    me->spin = 0;
+    me->next  = LOCKED;
+    me->spin  = 0;
+    me->state = MCS_WAITING;
 
+    sspfd_phase_begin(SSPFD_JOIN);
     // The atomic instruction is needed when two threads try to put themselves
     // at the tail of the list at the same time
     tail = xchg_64((void *)&impl->tail, (void *)me);
 
     /* No one there? */
     if (!tail) {
+        sspfd_phase_end(SSPFD_JOIN);
         DEBUG("[%d] (1) Locking lock=%p tail=%p me=%p\n", cur_thread_id, impl,
               impl->tail, me);
         return 0;
@@ -96,8 +121,50 @@ static int __mcs_mutex_lock(mcs_mutex_t *impl, mcs_node_t *me) {
     /* Someone there, need to link in */
     tail->next = me;
     COMPILER_BARRIER();
+    sspfd_phase_end(SSPFD_JOIN);
+    return 1;
+}
+
+static int __mcs_mutex_lock(mcs_mutex_t *impl, mcs_node_t *me) {
+    assert(me != NULL);
+
+    if (!mcs_reclaim(me) && !mcs_enqueue(impl, me))
+        return 0;
+
+    sspfd_phase_begin(SSPFD_WAIT);
+    waiting_policy_sleep(&me->spin);
+    sspfd_phase_end(SSPFD_WAIT);
+
+    DEBUG("[%d] (2) Locking lock=%p tail=%p me=%p\n", cur_thread_id, impl,
+          impl->tail, me);
+    return 0;
+}
+
+static int __mcs_mutex_timedlock(mcs_mutex_t *impl, mcs_node_t *me,
+                                 const struct timespec *abstime) {
+    unsigned int i;
+
+    assert(me != NULL);
+
+    if (!mcs_reclaim(me) && !mcs_enqueue(impl, me))
+        return 0;
+
+    sspfd_phase_begin(SSPFD_WAIT);
+    for (i = 1; me->state == MCS_WAITING; i++) {
+        // Leave the node in the queue, unless the lock was just granted
+        if (i % MCS_TIMEDLOCK_CHECK == 0 && timespec_passed(abstime) &&
+            __sync_bool_compare_and_swap(&me->state, MCS_WAITING,
+                                         MCS_ABANDONED)) {
+            sspfd_phase_end(SSPFD_WAIT);
+            DEBUG("[%d] Timed out lock=%p me=%p\n", cur_thread_id, impl, me);
+            return ETIMEDOUT;
+        }
+        CPU_PAUSE();
+    }
 
+    // Granted, wait for the handoff
     waiting_policy_sleep(&me->spin);
+    sspfd_phase_end(SSPFD_WAIT);
 
     DEBUG("[%d] (2) Locking lock=%p tail=%p me=%p\n", cur_thread_id, impl,
           impl->tail, me);
@@ -117,11 +184,28 @@ int mcs_mutex_lock(mcs_mutex_t *impl, mcs_node_t *me) {
     return ret;
 }
 
+int mcs_mutex_timedlock(mcs_mutex_t *impl, mcs_node_t *me,
+                        const struct timespec *abstime) {
+    int ret = __mcs_mutex_timedlock(impl, me, abstime);
+#if COND_VAR
+    if (ret == 0) {
+        DEBUG_PTHREAD("[%d] Lock posix=%p\n", cur_thread_id, &impl->posix_lock);
+        assert(REAL(pthread_mutex_lock)(&impl->posix_lock) == 0);
+    }
+#endif
+    return ret;
+}
+
 int mcs_mutex_trylock(mcs_mutex_t *impl, mcs_node_t *me) {
     mcs_node_t *tail;
 
     assert(me != NULL);
 
+    // Fail without an atomic instruction on a busy lock. This also keeps the
+    // node untouched if it was abandoned in the queue by a timed waiter.
+    if (impl->tail)
+        return EBUSY;
+
     me->next = 0;
     me->spin = LOCKED;
 
@@ -147,23 +231,52 @@ int mcs_mutex_trylock(mcs_mutex_t *impl, mcs_node_t *me) {
 }
 
 static void __mcs_mutex_unlock(mcs_mutex_t *impl, mcs_node_t *me) {
+    mcs_node_t *cur = me, *succ;
+    int granted = 0;
+
     DEBUG("[%d] Unlocking lock=%p tail=%p me=%p\n", cur_thread_id, impl,
           impl->tail, me);
 
-    /* No successor yet? */
-    if (!me->next) {
-        // The atomic instruction is needed if a thread between the previous if
-        // and now has enqueued itself at the tail
-        if (__sync_val_compare_and_swap(&impl->tail, me, 0) == me)
-            return;
-
-        /* Wait for successor to appear */
-        while (!me->next)
-            CPU_PAUSE();
+    // Only handoffs to a waiter are recorded
+    sspfd_phase_begin(SSPFD_HANDOFF);
+
+    // cur is either me or a node abandoned by a timed waiter
+    while (!granted) {
+        /* No successor yet? */
+        if (!(succ = cur->next)) {
+            // The atomic instruction is needed if a thread between the previous
+            // if and now has enqueued itself at the tail
+            if (__sync_val_compare_and_swap(&impl->tail, cur, 0) == cur) {
+                if (cur != me)
+                    cur->state = MCS_IDLE;
+                return;
+            }
+
+            /* Wait for successor to appear */
+            while (!(succ = cur->next))
+                CPU_PAUSE();
+        }
+        if (cur != me)
+            cur->state = MCS_IDLE;
+
+        // Either grant the lock to the successor, or skip it if it timed out.
+        // Its owner may take it back in between, then try again.
+        for (;;) {
+            if (__sync_bool_compare_and_swap(&succ->state, MCS_WAITING,
+                                             MCS_GRANTED)) {
+                granted = 1;
+                break;
+            }
+            if (__sync_bool_compare_and_swap(&succ->state, MCS_ABANDONED,
+                                             MCS_SKIPPED))
+                break;
+        }
+        cur = succ;
     }
 
     /* Unlock next one */
-    waiting_policy_wake(&me->next->spin);
+    waiting_policy_wake(&succ->spin);
+    sspfd_phase_end(SSPFD_HANDOFF);
 }
 
 void mcs_mutex_unlock(mcs_mutex_t *impl, mcs_node_t *me) {
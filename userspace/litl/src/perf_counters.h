@@ -0,0 +1,326 @@
+/*
+ * Hardware performance counters around critical sections.
+ *
+ * Built with PERF_COUNTERS=1 (make perf_counters), every thread opens a few
+ * perf events (instructions, cache misses, remote-node accesses) counting
+ * user space only, and reads them with rdpmc at each lock phase logged by
+ * interpose.c.  The counts between two phases go to exactly one bucket:
+ *
+ *   acquire  -- from the lock request until the lock is held
+ *   cs       -- while the lock is the innermost one held
+ *   release  -- inside the unlock call
+ *   outside  -- while no lock is held (not attributed to any lock)
+ *
+ * Counts are kept in per-thread tables, so recording them does not move
+ * any cache line between cores.  The tables are merged and written as CSV
+ * at exit, to stderr or to the file named by LITL_PERF_OUTPUT.
+ */
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+#define PERF_NUM_EVENTS 3
+#define PERF_TABLE_SIZE 1024 /* Locks tracked per thread, power of two */
+#define PERF_MAX_DEPTH 16    /* Nested locks tracked per thread */
+
+enum { PERF_ACQUIRE, PERF_CS, PERF_RELEASE, PERF_NUM_BUCKETS };
+
+static const char *perf_event_names[PERF_NUM_EVENTS] = {
+    "instructions", "cache_misses", "remote_accesses"};
+static const char *perf_bucket_names[PERF_NUM_BUCKETS] = {"acquire", "cs",
+                                                          "release"};
+
+typedef struct {
+    void *lock; /* NULL = free slot */
+    uint64_t acquisitions;
+    uint64_t counts[PERF_NUM_BUCKETS][PERF_NUM_EVENTS];
+} perf_lock_stats_t;
+
+typedef struct {
+    int fd[PERF_NUM_EVENTS];
+    struct perf_event_mmap_page *page[PERF_NUM_EVENTS];
+    uint64_t last[PERF_NUM_EVENTS];
+    void *held[PERF_MAX_DEPTH];
+    int depth;
+    uint64_t outside[PERF_NUM_EVENTS];
+    perf_lock_stats_t other; /* Locks that did not fit in the table */
+    perf_lock_stats_t table[PERF_TABLE_SIZE];
+} perf_thread_t;
+
+static perf_thread_t *perf_threads[MAX_THREADS];
+static __thread perf_thread_t *perf_self;
+
+static int perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_thread_init(void) {
+    static volatile int warned = 0;
+    const uint32_t types[PERF_NUM_EVENTS]   = {PERF_TYPE_HARDWARE,
+                                             PERF_TYPE_HARDWARE,
+                                             PERF_TYPE_HW_CACHE};
+    const uint64_t configs[PERF_NUM_EVENTS] = {
+        PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+    perf_thread_t *t = perf_threads[cur_thread_id];
+    int i;
+
+    if (t != NULL) {
+        // A thread reusing an ID keeps the table of the previous ones, but
+        // counters only count the thread that opened them
+        for (i = 0; i < PERF_NUM_EVENTS; i++) {
+            if (t->page[i] != NULL)
+                munmap(t->page[i], getpagesize());
+            if (t->fd[i] >= 0)
+                close(t->fd[i]);
+            t->page[i] = NULL;
+            t->last[i] = 0;
+        }
+        t->depth = 0;
+    } else {
+        t = calloc(1, sizeof(perf_thread_t));
+        if (t == NULL) {
+            fprintf(stderr, "Unable to allocate the perf counter table\n");
+            exit(-1);
+        }
+    }
+
+    for (i = 0; i < PERF_NUM_EVENTS; i++) {
+        t->fd[i] = perf_open(types[i], configs[i]);
+        if (t->fd[i] < 0) {
+            // Unsupported events just read as 0
+            if (__sync_bool_compare_and_swap(&warned, 0, 1))
+                perror("perf_event_open (counters will read as 0)");
+            continue;
+        }
+        t->page[i] = mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED,
+                          t->fd[i], 0);
+        if (t->page[i] == MAP_FAILED)
+            t->page[i] = NULL;
+    }
+
+    perf_threads[cur_thread_id] = t;
+    perf_self                   = t;
+}
+
+static inline uint64_t perf_read(perf_thread_t *t, int i) {
+    struct perf_event_mmap_page *pc = t->page[i];
+    uint64_t count;
+    uint32_t seq, idx;
+
+    if (t->fd[i] < 0)
+        return 0;
+
+    if (pc != NULL && pc->cap_user_rdpmc) {
+        do {
+            seq = pc->lock;
+            COMPILER_BARRIER();
+            idx   = pc->index;
+            count = pc->offset;
+            if (idx) {
+                int64_t pmc = rdpmc(idx - 1);
+                pmc <<= 64 - pc->pmc_width;
+                pmc >>= 64 - pc->pmc_width;
+                count += pmc;
+            }
+            COMPILER_BARRIER();
+        } while (pc->lock != seq);
+        return count;
+    }
+
+    // No user-space rdpmc: fall back to the (much slower) syscall
+    if (read(t->fd[i], &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return count;
+}
+
+static inline perf_lock_stats_t *perf_lock_stats(perf_thread_t *t,
+                                                 void *lock) {
+    uint64_t h = ((uintptr_t)lock >> 4) * 0x9e3779b97f4a7c15ull;
+    unsigned int i, slot;
+
+    for (i = 0; i < PERF_TABLE_SIZE; i++) {
+        slot = (h + i) & (PERF_TABLE_SIZE - 1);
+        if (t->table[slot].lock == lock)
+            return &t->table[slot];
+        if (t->table[slot].lock == NULL) {
+            t->table[slot].lock = lock;
+            return &t->table[slot];
+        }
+    }
+    return &t->other;
+}
+
+/*
+ * Charge the counts since the previous phase to "dst" (NULL = outside any
+ * critical section).
+ */
+static inline void perf_charge(perf_thread_t *t, uint64_t *dst) {
+    int i;
+    for (i = 0; i < PERF_NUM_EVENTS; i++) {
+        uint64_t now = perf_read(t, i);
+        if (dst != NULL)
+            dst[i] += now - t->last[i];
+        else
+            t->outside[i] += now - t->last[i];
+        t->last[i] = now;
+    }
+}
+
+static inline void perf_counters_phase(void *lock, uint8_t csphase) {
+    perf_thread_t *t = perf_self;
+    perf_lock_stats_t *s;
+    int i;
+
+    // Threads not created through pthread_create (e.g. before the
+    // constructor ran) are not instrumented
+    if (t == NULL)
+        return;
+
+    switch (csphase) {
+    case BEFORE_ENTER_CS:
+        // Waiting for a nested lock is still part of the outer CS
+        i = t->depth < PERF_MAX_DEPTH ? t->depth : PERF_MAX_DEPTH;
+        perf_charge(t, i > 0 ? perf_lock_stats(t, t->held[i - 1])->counts[PERF_CS]
+                             : NULL);
+        break;
+    case AFTER_ENTER_CS:
+        s = perf_lock_stats(t, lock);
+        perf_charge(t, s->counts[PERF_ACQUIRE]);
+        s->acquisitions++;
+        if (t->depth < PERF_MAX_DEPTH)
+            t->held[t->depth] = lock;
+        t->depth++;
+        break;
+    case BEFORE_EXIT_CS:
+        perf_charge(t, perf_lock_stats(t, lock)->counts[PERF_CS]);
+        break;
+    case AFTER_EXIT_CS:
+        perf_charge(t, perf_lock_stats(t, lock)->counts[PERF_RELEASE]);
+        if (t->depth > PERF_MAX_DEPTH) {
+            t->depth--;
+            break;
+        }
+        // Locks are not always released in LIFO order
+        for (i = t->depth - 1; i >= 0; i--) {
+            if (t->held[i] == lock) {
+                memmove(&t->held[i], &t->held[i + 1],
+                        (t->depth - i - 1) * sizeof(void *));
+                t->depth--;
+                break;
+            }
+        }
+        break;
+    }
+}
+
+static int perf_cmp_acquisitions(const void *a, const void *b) {
+    const perf_lock_stats_t *x = a, *y = b;
+    return x->acquisitions < y->acquisitions
+               ? 1
+               : (x->acquisitions > y->acquisitions ? -1 : 0);
+}
+
+static void perf_print_row(FILE *out, const char *lock, uint64_t acquisitions,
+                           const char *phase, const uint64_t *counts) {
+    int e;
+    fprintf(out, "%s,%lu,%s", lock, acquisitions, phase);
+    for (e = 0; e < PERF_NUM_EVENTS; e++)
+        fprintf(out, ",%lu", counts[e]);
+    fprintf(out, "\n");
+}
+
+static void perf_counters_report(void) {
+    const int max_locks = PERF_TABLE_SIZE * 4;
+    perf_lock_stats_t *all, other;
+    uint64_t outside[PERF_NUM_EVENTS] = {0};
+    int nthreads = last_thread_id < MAX_THREADS ? last_thread_id : MAX_THREADS;
+    int i, j, k, b, e, nlocks = 0;
+    const char *path = getenv("LITL_PERF_OUTPUT");
+    FILE *out        = stderr;
+    char name[32];
+
+    all = calloc(max_locks, sizeof(perf_lock_stats_t));
+    if (all == NULL)
+        return;
+    memset(&other, 0, sizeof(other));
+
+    // Merge the per-thread tables by lock
+    for (i = 0; i < nthreads; i++) {
+        perf_thread_t *t = perf_threads[i];
+        if (t == NULL)
+            continue;
+        for (e = 0; e < PERF_NUM_EVENTS; e++)
+            outside[e] += t->outside[e];
+        for (j = 0; j <= PERF_TABLE_SIZE; j++) {
+            perf_lock_stats_t *src =
+                j < PERF_TABLE_SIZE ? &t->table[j] : &t->other;
+            perf_lock_stats_t *dst = &other;
+            if (src->acquisitions == 0)
+                continue;
+            if (src != &t->other) {
+                for (k = 0; k < nlocks && all[k].lock != src->lock; k++)
+                    ;
+                if (k < max_locks) {
+                    dst       = &all[k];
+                    dst->lock = src->lock;
+                    if (k == nlocks)
+                        nlocks++;
+                }
+            }
+            dst->acquisitions += src->acquisitions;
+            for (b = 0; b < PERF_NUM_BUCKETS; b++)
+                for (e = 0; e < PERF_NUM_EVENTS; e++)
+                    dst->counts[b][e] += src->counts[b][e];
+        }
+    }
+    qsort(all, nlocks, sizeof(perf_lock_stats_t), perf_cmp_acquisitions);
+
+    if (path != NULL && (out = fopen(path, "w")) == NULL) {
+        perror(path);
+        out = stderr;
+    }
+
+    fprintf(out, "lock,acquisitions,phase");
+    for (e = 0; e < PERF_NUM_EVENTS; e++)
+        fprintf(out, ",%s", perf_event_names[e]);
+    fprintf(out, "\n");
+    for (k = 0; k < nlocks; k++) {
+        snprintf(name, sizeof(name), "%p", all[k].lock);
+        for (b = 0; b < PERF_NUM_BUCKETS; b++)
+            perf_print_row(out, name, all[k].acquisitions,
+                           perf_bucket_names[b], all[k].counts[b]);
+    }
+    if (other.acquisitions > 0) {
+        for (b = 0; b < PERF_NUM_BUCKETS; b++)
+            perf_print_row(out, "other", other.acquisitions,
+                           perf_bucket_names[b], other.counts[b]);
+    }
+    perf_print_row(out, "none", 0, "outside", outside);
+
+    if (out != stderr)
+        fclose(out);
+    free(all);
+}
+
+#endif // __PERF_COUNTERS_H__
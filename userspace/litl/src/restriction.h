@@ -0,0 +1,146 @@
+/*
+ * Concurrency restriction in front of the queue-based locks.
+ *
+ * Dave Dice. 2015.
+ * Malthusian Locks.
+ * In CoRR (arXiv).
+ *
+ * src/malthusian.c culls the surplus waiters from the queue of an MCS lock.
+ * This is the same idea as a layer that interpose.c puts in front of any lock
+ * whose header defines SUPPORT_RESTRICTION, enabled with LITL_RESTRICT=n:
+ * - At most n threads per mutex are active, i.e., between the lock and the
+ *   unlock (waiting in the queue of the lock or holding it).
+ * - A thread that finds n active threads becomes passive: it waits in a FIFO
+ *   queue in front of the lock, where only the first passive thread spins
+ *   (and yields its core from time to time), while the others wait with the
+ *   waiting policy of the library.
+ * - The first passive thread becomes active when the lock has no active thread
+ *   left, or when an active thread passes it its slot, which the unlocking
+ *   thread does every RESTRICTION_ROTATE unlocks so that all the threads
+ *   eventually circulate.
+ * - A thread that comes back to the lock while a slot is free takes it even if
+ *   there are passive threads, so that the set of circulating threads stays
+ *   small (and its data in the caches).
+ * Trylocks, timed locks and threads coming back from a condition variable take
+ * a slot without waiting, and threads give their slot back while they wait on
+ * a condition variable. Spinlocks and rwlocks are not restricted.
+ */
+#ifndef __RESTRICTION_H__
+#define __RESTRICTION_H__
+
+#include <sched.h>
+
+#include "waiting_policy.h"
+#include "utils.h"
+
+#ifndef SUPPORT_RESTRICTION
+#define SUPPORT_RESTRICTION 0
+#endif
+
+// Only built for the locks that opt in, as it needs a generic waiting policy
+#if SUPPORT_RESTRICTION
+#define RESTRICTION_ROTATE 1024 //!\\ Must be a power of 2!
+// Spins of the first passive thread between two sched_yield
+#define RESTRICTION_YIELD 1024
+
+typedef struct restriction_node {
+    struct restriction_node *volatile next;
+    char __pad[pad_to_cache_line(sizeof(struct restriction_node *))];
+    volatile int spin __attribute__((aligned(L_CACHE_LINE_SIZE)));
+} restriction_node_t __attribute__((aligned(L_CACHE_LINE_SIZE)));
+
+typedef struct restriction {
+    volatile int active;
+    volatile int handoff;    // A slot passed to the first passive thread
+    unsigned int unlocks;    // Only written by the lock holder
+    struct restriction_node *volatile passive; // Tail of the passive queue
+} restriction_t;
+
+// Maximum number of active threads per mutex, 0 when disabled
+extern int restriction_limit;
+
+// A thread is passive for one mutex at a time
+extern __thread restriction_node_t restriction_node;
+
+static inline void restriction_init(restriction_t *r) {
+    r->active  = 0;
+    r->handoff = 0;
+    r->unlocks = 0;
+    r->passive = NULL;
+}
+
+static inline int restriction_try_enter(restriction_t *r) {
+    int active = r->active, prev;
+
+    while (active < restriction_limit) {
+        prev = __sync_val_compare_and_swap(&r->active, active, active + 1);
+        if (prev == active)
+            return 1;
+        active = prev;
+    }
+    return 0;
+}
+
+// Before a blocking lock
+static inline void restriction_enter(restriction_t *r) {
+    restriction_node_t *me = &restriction_node, *pred;
+    unsigned int i;
+
+    if (!restriction_limit || restriction_try_enter(r))
+        return;
+
+    me->next = NULL;
+    me->spin = LOCKED;
+
+    pred = xchg_64((void *)&r->passive, (void *)me);
+    if (pred) {
+        pred->next = me;
+        COMPILER_BARRIER();
+        waiting_policy_sleep(&me->spin);
+    }
+
+    // First passive thread: wait for a slot
+    for (i = 1;; i++) {
+        if (r->handoff && __sync_bool_compare_and_swap(&r->handoff, 1, 0))
+            break;
+        if (r->active == 0 && restriction_try_enter(r))
+            break;
+
+        if (i % RESTRICTION_YIELD == 0)
+            sched_yield();
+        else
+            CPU_PAUSE();
+    }
+
+    // Leave the passive queue
+    if (!me->next) {
+        if (__sync_val_compare_and_swap(&r->passive, me, NULL) == me)
+            return;
+
+        /* Wait for successor to appear */
+        while (!me->next)
+            CPU_PAUSE();
+    }
+    waiting_policy_wake(&me->next->spin);
+}
+
+// After a successful trylock or timed lock, or a condition variable wait
+static inline void restriction_taken(restriction_t *r) {
+    if (restriction_limit)
+        __sync_fetch_and_add(&r->active, 1);
+}
+
+// Before the unlock, or a condition variable wait
+static inline void restriction_leave(restriction_t *r) {
+    if (!restriction_limit)
+        return;
+
+    if (r->passive && (++r->unlocks & (RESTRICTION_ROTATE - 1)) == 0 &&
+        __sync_bool_compare_and_swap(&r->handoff, 0, 1))
+        return;
+
+    __sync_fetch_and_sub(&r->active, 1);
+}
+#endif // SUPPORT_RESTRICTION
+
+#endif // __RESTRICTION_H__
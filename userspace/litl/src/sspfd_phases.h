@@ -0,0 +1,70 @@
+/*
+ * Cycle-level timing of lock phases with sspfd.
+ *
+ * Built with SSPFD_PHASES=1 (make sspfd_phases), every thread gets one sspfd
+ * store per phase below.  interpose.c times the whole lock and unlock calls;
+ * lock algorithms can time their own steps with sspfd_phase_begin/end:
+ *
+ *   lock     -- pthread_*_lock, from the request until the lock is held
+ *   unlock   -- pthread_*_unlock
+ *   join     -- enqueuing on the lock (e.g., the swap on the MCS tail)
+ *   wait     -- waiting for the lock to be handed over
+ *   combine  -- a combiner executing the critical sections of other threads
+ *   handoff  -- passing the lock to the next waiter
+ *
+ * Every store keeps the last SSPFD_ENTRIES samples.  At exit, the samples of
+ * all threads are merged and the sspfd statistics of each phase are printed.
+ * When not built with SSPFD_PHASES, the hooks compile to nothing.
+ */
+#ifndef __SSPFD_PHASES_H__
+#define __SSPFD_PHASES_H__
+
+#ifndef SSPFD_PHASES
+#define SSPFD_PHASES 0
+#endif
+
+enum {
+    SSPFD_LOCK,
+    SSPFD_UNLOCK,
+    SSPFD_JOIN,
+    SSPFD_WAIT,
+    SSPFD_COMBINE,
+    SSPFD_HANDOFF,
+    SSPFD_NUM_PHASES
+};
+
+#if SSPFD_PHASES
+// Must come after utils.h, which provides getticks() and PREFETCHW
+#define _H_GETTICKS_
+#include <sspfd.h>
+
+#ifndef SSPFD_ENTRIES
+#define SSPFD_ENTRIES (1 << 16) /* Samples kept per phase, power of two */
+#endif
+
+// Number of samples taken by the current thread, per phase (NULL until the
+// thread has its stores)
+extern __thread uint64_t *sspfd_phase_count;
+
+#define sspfd_phase_begin(p)                                                   \
+    do {                                                                       \
+        if (sspfd_phase_count != NULL)                                         \
+            _sspfd_s[p] = getticks();                                          \
+    } while (0)
+
+#define sspfd_phase_end(p)                                                     \
+    do {                                                                       \
+        if (sspfd_phase_count != NULL)                                         \
+            sspfd_store[p][sspfd_phase_count[p]++ & (SSPFD_ENTRIES - 1)] =     \
+                getticks() - _sspfd_s[p] - sspfd_correction;                   \
+    } while (0)
+#else
+#define sspfd_phase_begin(p)                                                   \
+    do {                                                                       \
+    } while (0)
+#define sspfd_phase_end(p)                                                     \
+    do {                                                                       \
+    } while (0)
+#endif
+
+#endif // __SSPFD_PHASES_H__
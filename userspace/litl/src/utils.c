@@ -28,6 +28,12 @@
 #include <stdint.h>
 #include "utils.h"
 
+#if defined(WAITING_TIMESLICE)
+// Shared by the waiters, see waiting_policy.h
+volatile uint64_t timeslice_last_preemption;
+volatile int timeslice_parked;
+#endif
+
 inline void *alloc_cache_align(size_t n) {
     void *res = 0;
     if ((MEMALIGN(&res, L_CACHE_LINE_SIZE, cache_align(n)) < 0) || !res) {
@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifndef __UTILS_H__
@@ -119,6 +120,16 @@ static inline uint64_t rdtsc(void) {
     return low | ((uint64_t)high) << 32;
 }
 
+// Whether the CLOCK_REALTIME date abstime (as given to pthread_*_timedlock)
+// has passed
+static inline int timespec_passed(const struct timespec *abstime) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec > abstime->tv_sec ||
+           (now.tv_sec == abstime->tv_sec && now.tv_nsec >= abstime->tv_nsec);
+}
+
 // EPFL libslock
 #define my_random xorshf96
 #define getticks rdtsc
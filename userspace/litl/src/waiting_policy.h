@@ -33,6 +33,19 @@
  **/
 #define SPINNING_THRESHOLD 2700LL
 
+/**
+ * Time-slice awareness (WAITING_TIMESLICE).
+ * A spinning thread that sees more than TIMESLICE_PREEMPTION_GAP cycles
+ * between two consecutive reads of the timestamp counter has been
+ * descheduled while waiting, which means that there are more running threads
+ * than cores. It publishes the date in timeslice_last_preemption, and until
+ * TIMESLICE_WINDOW cycles have passed, the waiters stop spinning after
+ * SPINNING_THRESHOLD iterations to leave the cores to the lock holders.
+ * Without preemption, they spin like WAITING_SPINLOCK.
+ **/
+#define TIMESLICE_PREEMPTION_GAP 100000ULL
+#define TIMESLICE_WINDOW 300000000ULL
+
 /**
  * waiting_policy_sleep: wait until *var is 0 (and potentially send the thread
  * to sleep)
@@ -56,13 +69,14 @@
  */
 #if defined(WAITING_ORIGINAL) &&                                               \
     (defined(WAITING_SPINLOCK) || defined(WAITING_SPINLOCK_ATOMIC) ||          \
-     defined(WAITING_SPIN_THEN_PARK))
+     defined(WAITING_SPIN_THEN_PARK) || defined(WAITING_TIMESLICE))
 #error "The lock algorithm used only support its original waiting policy"
 #endif
 
 #define __maybe_unused __attribute__((unused))
 
-#if defined(WAITING_PARK) || defined(WAITING_SPIN_THEN_PARK)
+#if defined(WAITING_PARK) || defined(WAITING_SPIN_THEN_PARK) ||              \
+    defined(WAITING_TIMESLICE)
 static inline int sys_futex(int *uaddr, int op, int val,
                             const struct timespec *timeout, int *uaddr2,
                             int val3) {
@@ -178,11 +192,66 @@ static inline void waiting_policy_wake(volatile int *var) {
         exit(-1);
     }
 }
+#elif defined(WAITING_TIMESLICE)
+#define WAITING_POLICY "WAITING_TIMESLICE"
+extern volatile uint64_t timeslice_last_preemption;
+extern volatile int timeslice_parked;
+
+/**
+ * To call in spin loops, with *last initialized with rdtsc() before the loop.
+ * Returns whether a spinning thread has been preempted recently.
+ **/
+static inline int timeslice_oversubscribed(uint64_t *last) {
+    uint64_t now = rdtsc();
+
+    if (now - *last > TIMESLICE_PREEMPTION_GAP)
+        timeslice_last_preemption = now;
+    *last = now;
+
+    return now - timeslice_last_preemption < TIMESLICE_WINDOW;
+}
+
+static inline void waiting_policy_sleep(volatile int *var) {
+    unsigned long long i = 0;
+    uint64_t last        = rdtsc();
+    int ret;
+
+    while (*var != UNLOCKED) {
+        CPU_PAUSE();
+        if (!timeslice_oversubscribed(&last) || ++i < SPINNING_THRESHOLD)
+            continue;
+
+        // The waker only calls futex if it sees a parked thread
+        __sync_fetch_and_add(&timeslice_parked, 1);
+        ret = sys_futex((int *)var, FUTEX_WAIT_PRIVATE, LOCKED, NULL, 0, 0);
+        if (ret == -1 && errno != EINTR && errno != EAGAIN) {
+            perror("Unable to futex wait");
+            exit(-1);
+        }
+        __sync_fetch_and_sub(&timeslice_parked, 1);
+
+        i    = 0;
+        last = rdtsc();
+    }
+}
+
+static inline void waiting_policy_wake(volatile int *var) {
+    *var = UNLOCKED;
+    __sync_synchronize();
+    if (timeslice_parked == 0)
+        return;
+
+    int ret = sys_futex((int *)var, FUTEX_WAKE_PRIVATE, UNLOCKED, NULL, 0, 0);
+    if (ret == -1) {
+        perror("Unable to futex wake");
+        exit(-1);
+    }
+}
 #elif defined(WAITING_ORIGINAL)
 #define WAITING_POLICY "WAITING_ORIGINAL"
 #else
 #error                                                                         \
-    "No waiting policy defined (WAITING_SPINLOCK | WAITING_SPINLOCK_ATOMIC | WAITING_SPIN_THEN_PARK | WAITING_PARK | WAITING_ORIGINAL)"
+    "No waiting policy defined (WAITING_SPINLOCK | WAITING_SPINLOCK_ATOMIC | WAITING_SPIN_THEN_PARK | WAITING_PARK | WAITING_TIMESLICE | WAITING_ORIGINAL)"
 #endif
 
 #endif // __WAITING_POLICY_H__